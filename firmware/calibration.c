@@ -0,0 +1,109 @@
+#include <stdint.h>
+
+#include "zappy-calibration.h"
+
+// Integer conversions between ADC/DAC codes and voltages, derived from zappy_cal once at boot by cal_init().
+// The CPU has no FPU, so these replace the soft-float routines that used to sit inside the charge and safe
+// polling loops. Every value here is in millivolts.
+//
+// Forward ADC paths use a Q8 slope per half LSB: x = 2*code - 1 is the ADC input in half-LSB steps (the 0->1
+// transition is at 0.5LSB), so mv = x * k / 256 + b, with the same two clamps at zero as the float path.
+// Worst-case rounding is about 16mV at full scale, against ~280mV per ADC LSB.
+// Inverse paths are only used at setup time and need more precision than 32 bits give, so they use Q32 in int64.
+// The sense resistor (mA -> mV for the current limits) and the energy accumulator scale are derived here too, so
+// cal_init() itself is the only soft-float left on the calibration path, and runs once.
+
+#define CAL_Q8(x)  ((int32_t) ((x) * 256.0f + 0.5f))
+#define CAL_Q32(x) ((int64_t) ((x) * 4294967296.0f + 0.5f))
+
+static int32_t adc_k[2];      // mV per half LSB, Q8, indexed by ADC_SLOW/ADC_FAST
+static int32_t adc_b[2];      // mV at the ADC input's zero
+static int64_t adc_inv_k[2];  // ADC codes per mV, Q32
+static int64_t adc_inv_b[2];  // ADC code at 0mV, Q32, includes the 0.5LSB offset
+static int32_t mk_k;          // MK vmon mV per half LSB, Q8
+static int64_t hvdac_k;       // HV DAC codes per mV, Q32
+static int64_t hvdac_b;       // HV DAC code at 0mV, Q32
+static uint32_t capres_q16;   // current sense resistor, ohms, Q16
+static uint64_t lsb_per_mj;   // energy accumulator LSBs per millijoule
+
+void cal_init(void) {
+  float half_lsb = zappy_cal.p5v_adc / 8192.0f;
+  float m[2] = {zappy_cal.slow_m, zappy_cal.fast_m};
+  float b[2] = {zappy_cal.slow_b, zappy_cal.fast_b};
+  int i;
+
+  for( i = ADC_SLOW; i <= ADC_FAST; i++ ) {
+    adc_k[i] = CAL_Q8(half_lsb * m[i] * 1000.0f);
+    adc_b[i] = (int32_t) (b[i] * 1000.0f + (b[i] < 0 ? -0.5f : 0.5f));
+    adc_inv_k[i] = CAL_Q32(1.0f / (2.0f * half_lsb * m[i] * 1000.0f));
+    adc_inv_b[i] = CAL_Q32(0.5f - b[i] / (2.0f * half_lsb * m[i]));
+  }
+
+  mk_k = CAL_Q8(zappy_cal.p5v_adc_logic / 8192.0f * 200.0f * 1000.0f); // 0-5V ADC corresponds to 0-1000V on supply
+
+  hvdac_k = CAL_Q32(zappy_cal.fs_dac / 1000.0f * zappy_cal.hvdac_m / 1000.0f);
+  hvdac_b = CAL_Q32(zappy_cal.hvdac_b);
+
+  capres_q16 = (uint32_t) (zappy_cal.capres * 65536.0f + 0.5f); // Q8 is ~100mV off at full scale
+  lsb_per_mj = (uint64_t) (zappy_cal.onejoule / 1000.0);
+}
+
+// convert the ADC binary code to millivolts on the HV side of the divider
+uint32_t adc_code_to_mv(uint16_t code, uint8_t adc_path) {
+  int32_t x = 2 * (int32_t) code - 1;
+  int32_t mv;
+
+  if( x < 0 )
+    x = 0;
+  mv = ((x * adc_k[adc_path] + 128) >> 8) + adc_b[adc_path];
+  if( mv < 0 )
+    mv = 0;
+
+  return (uint32_t) mv;
+}
+
+// convert millivolts into a *measurement* ADC binary code (not for HVDAC purposes)
+// used to program a "SCRAM" target for "do not exceed" feedback levels (if desired)
+// and for capacitor target voltage measurements
+uint16_t mv_to_adc_code(uint32_t mv, uint8_t adc_path) {
+  int64_t code = ((int64_t) mv * adc_inv_k[adc_path] + adc_inv_b[adc_path]) >> 32;
+
+  if( code < 0 )
+    code = 0;
+  if( code > 0xfff )
+    code = 0xfff;
+
+  return (uint16_t) code;
+}
+
+// convert ADC binary code to millivolts for the MKHV vmon supply; slightly negative at code 0
+int32_t mk_code_to_mv(uint16_t code) {
+  return ((2 * (int32_t) code - 1) * mk_k + 128) >> 8;
+}
+
+// convert a desired voltage on the MK HV supply to a code suitable for the HV dac
+uint16_t mv_to_hvdac_code(uint32_t mv) {
+  int64_t code = ((int64_t) mv * hvdac_k + hvdac_b) >> 32;
+
+  if( code < 0 )
+    code = 0;
+  if( code > 0xffff )
+    code = 0xffff;
+
+  return (uint16_t) code;
+}
+
+// convert a current through the sense resistor into the millivolts it drops (mA * ohms = mV)
+uint32_t ma_to_mv(uint32_t ma) {
+  uint64_t mv = ((uint64_t) ma * capres_q16 + 32768) >> 16;
+
+  if( mv > 0xffffffff )
+    mv = 0xffffffff;
+
+  return (uint32_t) mv;
+}
+
+// energy accumulator LSBs in one millijoule; 0 if the record has no energy calibration
+uint64_t energy_lsb_per_mj(void) {
+  return lsb_per_mj;
+}
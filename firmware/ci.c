@@ -17,6 +17,7 @@
 #include "dump.h"
 #include "ci.h"
 #include "uptime.h"
+#include "systime.h"
 #include "mdio.h"
 #include <net/microudp.h>
 #include <net/tftp.h>
@@ -27,6 +28,11 @@
 #include "plate.h"
 #include "temperature.h"
 #include "zap.h"
+#include "stats.h"
+#include "profile.h"
+#include "trace.h"
+#include "script.h"
+#include "netboot.h"
 #include "zappy-calibration.h"
 #include "ui.h"
 
@@ -61,10 +67,22 @@ static void ci_help(void)
 {
 	wputs("help        - this command");
 	wputs("reboot      - reboot CPU");
+	wputs("netboot     - netboot [file] - load firmware.img (firmware.bin + CRC) by tftp and run it; not for XIP builds");
 	wputs("uptime      - show uptime");
 	wputs("upload      - upload data");
+	wputs("bench       - bench [n] - n 64 KiB tftp_puts and the zap charge poll loop, timed");
 	wputs("plate       - plate [<lock/unlock>]");
-	wputs("zap         - zap [row, col, voltage] - all args ints");
+	wputs("zap         - zap [row, col, voltage, depth, max_current_ma, energy_cutoff, width_us] - all args ints");
+	wputs("script      - script [get <file> | load | run | clear] - plate script run on the device; load takes lines up to 'end'");
+	wputs("thermal     - thermal [on/off] - thermal-aware well scheduling");
+	wputs("sequence    - sequence [on/off] - run zaps from the gateware plate sequencer");
+	wputs("hvctl       - hvctl [on/off] - closed-loop HV charge controller");
+	wputs("summary     - summary [on/off] - upload only the pulse summary, not the waveform or energy");
+	wputs("protocol    - protocol [clear | add <V> <depth> <energy_cutoff> <interval_us> [width_us]] - pulses per well");
+	wputs("stats       - stats [wells | reset | dump] - per-phase zap latency; dump sends zappy-stats by tftp");
+	wputs("trace       - trace [n | clear | dump] - last n events of the post-mortem ring; dump sends zappy-trace by tftp");
+	wputs("profile     - profile [start [hz] | stop | dump] - PC sampling profiler; dump sends zappy-profile by tftp");
+	wputs("arc         - arc [<mA per sample> <V per sample> <holdoff samples>] - arc slope detector, 0 disables");
 	wputs("");
 	wputs("mr          - read address space");
 	wputs("mw          - write address space");
@@ -145,6 +163,27 @@ static char *get_token(char **str)
 	return get_token_generic(str, ' ');
 }
 
+// "script load": lines go to the script parser instead of the command chain until "end"
+static int script_loading;
+static int script_lineno;
+static int script_load_failed;
+
+static void script_load_line(char *str)
+{
+	if(strcmp(str, "end") == 0) {
+		script_loading = 0;
+		if(script_load_failed) {
+			script_clear();
+			printf("Script load failed, script cleared : zerr\n");
+		} else {
+			printf("Script: %d steps loaded : zpass\n", script.nsteps);
+		}
+		ci_prompt();
+	} else if(script_parse_line(str, ++script_lineno)) {
+		script_load_failed = 1; // keep swallowing lines, none of them may run as commands
+	}
+}
+
 static void reboot(void)
 {
 	REBOOT;
@@ -170,6 +209,10 @@ void ci_service(void)
 	status_service();
 
 	str = readstr();
+	if(str != NULL && script_loading) {
+	  script_load_line(str);
+	  return;
+	}
 	
 	if(str == NULL) {
 	  str = (char *) dummy;
@@ -185,22 +228,55 @@ void ci_service(void)
 	  ci_help();
 	  wputs("");
 	} else if(strcmp(token, "reboot") == 0) reboot();
+	else if(strcmp(token, "netboot") == 0) {
+	  token = get_token(&str);
+	  netboot(*token ? token : NETBOOT_FILE); // only comes back if the image didn't check out
+	}
 	else if(strcmp(token, "uptime") == 0)
 	  uptime_print();
 	else if(strcmp(token, "upload") == 0) {
 	  // send up 1 megabyte of data to benchmark upload speed
 	  unsigned int ip;
-	  int i;
 	  ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
 	  // send a megabyte
-	  int start, stop;
-	  elapsed(&start, -1);
+	  uint64_t start = systime_now();
 	  tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, "zappy-log.1", (void *)MONITOR_BASE, depth*4);
-	  elapsed(&stop, -1);
-	  i = stop - start;
-	  if( i < 0 ) i += timer0_reload_read();
+	  uint64_t ticks = systime_elapsed_since(start);
 	  printf("Elapsed ticks for log upload: %d, or %dms for %d bytes\n",
-		 i, (i)*1000/CONFIG_CLOCK_FREQUENCY, depth*4);
+		 (uint32_t) ticks, systime_to_ms(ticks), depth*4);
+	} else if(strcmp(token, "bench") == 0) {
+	  // the two hot paths __fast (fast.h) is for; run on USE_FAST=yes and no builds and compare
+	  unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+	  int n = 8, i;
+	  uint32_t ms, min_ms = 0xFFFFFFFF, max_ms = 0, total_ms = 0, poll_min, poll_max;
+	  token = get_token(&str);
+	  if( *token )
+	    n = strtoul(token, NULL, 0);
+	  if( n < 1 )
+	    n = 1;
+	  for( i = 0; i < n; i++ ) {
+	    uint64_t start = systime_now();
+	    if( tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, "zappy-bench", (void *)MAIN_RAM_BASE, 64*1024) < 0 ) {
+	      printf( "Bench: tftp_put %d failed : zerr\n", i + 1 );
+	      break;
+	    }
+	    ms = systime_to_ms(systime_elapsed_since(start));
+	    total_ms += ms;
+	    if( ms < min_ms ) min_ms = ms;
+	    if( ms > max_ms ) max_ms = ms;
+	  }
+	  if( i == n )
+	    printf( "Bench: %d tftp_puts of 64 KiB, min %d mean %d max %d ms, %d KiB/s : zinfo\n", n, min_ms,
+		    total_ms / n, max_ms, total_ms ? n * 64 * 1000 / total_ms : 0 );
+	  zap_poll_bench(100000, &poll_min, &poll_max);
+	  printf( "Bench: charge poll pass min %d max %d ticks, jitter %d ns (%s) : zinfo\n", poll_min, poll_max,
+		  (poll_max - poll_min) * 1000 / SYSTIME_TICKS_PER_US,
+#ifdef FAST_SRAM
+		  "__fast in sram"
+#else
+		  "all in main_ram"
+#endif
+		  );
 #if 0
 	} else if(strcmp(token, "benchmark") == 0) {
 	  // send up 1 megabyte of data to benchmark upload speed
@@ -230,22 +306,18 @@ void ci_service(void)
 	    ;
 #endif
 	} else if(strcmp(token, "acquire") == 0) {
-	  int acq_timer, start_time;
 	  printf("Testing acquisition with depth %d\n", depth);
-	  monitor_period_write(CONFIG_CLOCK_FREQUENCY / 1000000); // shoot for 1 microsecond period
+	  monitor_period_write(1); // keep every sample of the 1 MSPS stream: 1 microsecond period
+	  monitor_circular_write(0);
 	  monitor_depth_write(depth);
-	  elapsed(&acq_timer, -1);
-	  start_time = acq_timer;
+	  uint64_t start = systime_now();
 	  monitor_acquire_write(1); // start acquisition
 	  while( monitor_done_read() ) // wait for done to go 0
 	    ;
 	  while( monitor_done_read() == 0 ) // wait for done to go back to a 1
 	    ;
-	  elapsed(&acq_timer, -1);
-	  int delta = acq_timer - start_time;
-	  if( delta < 0 )
-	    delta += timer0_reload_read();
-	  printf("Acquisition finished in %d ticks or %d ms. Overrun status: %d\n", delta, (delta)*1000/CONFIG_CLOCK_FREQUENCY,
+	  uint64_t ticks = systime_elapsed_since(start);
+	  printf("Acquisition finished in %d ticks or %d ms. Dropped samples: %d\n", (uint32_t) ticks, systime_to_ms(ticks),
 		 monitor_overrun_read());
 	  printf("Run 'upload' to get a copy of the data\n");
 	} else if(strcmp(token, "zap") == 0) {
@@ -255,21 +327,148 @@ void ci_service(void)
 	  uint32_t time_us = strtoul(get_token(&str), NULL, 0);
 	  int32_t max_current_ma = strtol(get_token(&str), NULL, 0); // max_current in mA
 	  uint32_t energy_cutoff = strtoul(get_token(&str), NULL, 0); // energy cutoff in counts
-	  // turn current into a voltage by multiplying it by capres
-	  float max_voltage = (((float) max_current_ma) / 1000.0) * zappy_cal.capres;
-	  if( max_voltage > 1000.0 ) 
-	    max_voltage = 1000.0;
-	  int16_t max_current_code;
-	  if( max_current_ma < 0 )
-	    max_current_code = -1; // tells the loop to ignore the setting
-	  else {
-	    // we assume ADC_SLOW is the "master" calibration path for the reference curves
-	    max_current_code = (int16_t) convert_voltage_adc_code(max_voltage, ADC_SLOW);
-	    if( max_current_code > 0xfff )
-	      max_current_code = 0xfff;
-	  }
+	  uint32_t width_us = strtoul(get_token(&str), NULL, 0); // hardware pulse width, optional; 0 or missing disables
+	  int16_t max_current_code = zap_max_current_code(max_current_ma);
 	  printf( "debug: do_zap with max_current_code = %d\n", max_current_code );
-	  do_zap(row, col, voltage, time_us, max_current_code, energy_cutoff);
+	  do_zap(row, col, voltage, time_us, max_current_code, energy_cutoff, width_us);
+	} else if(strcmp(token, "script") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "get") == 0) {
+	    script_fetch(get_token(&str));
+	    script_print();
+	  } else if(strcmp(token, "load") == 0) {
+	    script_clear();
+	    script_loading = 1;
+	    script_lineno = 0;
+	    script_load_failed = 0;
+	    printf("Loading script, finish with 'end'\n");
+	  } else if(strcmp(token, "run") == 0) {
+	    script_run();
+	  } else if(strcmp(token, "clear") == 0) {
+	    script_clear();
+	  } else {
+	    script_print();
+	  }
+	} else if(strcmp(token, "thermal") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "on") == 0) {
+	    zap_thermal = 1;
+	  } else if(strcmp(token, "off") == 0) {
+	    zap_thermal = 0;
+	  }
+	  printf( "Thermal scheduling: %s\n", zap_thermal ? "on" : "off" );
+	} else if(strcmp(token, "sequence") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "on") == 0) {
+	    zap_sequenced = 1;
+	  } else if(strcmp(token, "off") == 0) {
+	    zap_sequenced = 0;
+	  }
+	  printf( "Sequenced zaps: %s\n", zap_sequenced ? "on" : "off" );
+	} else if(strcmp(token, "hvctl") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "on") == 0) {
+	    zap_hvctl = 1;
+	  } else if(strcmp(token, "off") == 0) {
+	    zap_hvctl = 0;
+	  }
+	  printf( "HV charge controller: %s\n", zap_hvctl ? "on" : "off" );
+	} else if(strcmp(token, "summary") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "on") == 0) {
+	    zap_summary_only = 1;
+	  } else if(strcmp(token, "off") == 0) {
+	    zap_summary_only = 0;
+	  }
+	  printf( "Summary-only uploads: %s\n", zap_summary_only ? "on" : "off" );
+	} else if(strcmp(token, "protocol") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "clear") == 0) {
+	    zap_protocol.npulses = 0;
+	  } else if(strcmp(token, "add") == 0) {
+	    zap_pulse pulse;
+	    pulse.voltage = strtoul(get_token(&str), NULL, 0);
+	    pulse.depth = strtoul(get_token(&str), NULL, 0);
+	    pulse.energy_cutoff = strtoul(get_token(&str), NULL, 0);
+	    pulse.interval_us = strtoul(get_token(&str), NULL, 0);
+	    pulse.width_us = strtoul(get_token(&str), NULL, 0);
+	    if( zap_protocol.npulses >= PROTOCOL_MAX_PULSES ) {
+	      printf( "Protocol is full at %d pulses : zerr\n", PROTOCOL_MAX_PULSES );
+	    } else if( pulse.voltage > 1000 || pulse.depth < 2 ) {
+	      printf( "Pulse out of range: %d V, %d samples : zerr\n", pulse.voltage, pulse.depth );
+	    } else {
+	      zap_protocol.pulse[zap_protocol.npulses++] = pulse;
+	    }
+	  }
+	  if( zap_protocol.npulses == 0 )
+	    printf( "Protocol: single pulse\n" );
+	  for( int i = 0; i < zap_protocol.npulses; i++ )
+	    printf( "Pulse %d: %d V, %d samples, energy cutoff %d, interval %d us, width %d us\n", i + 1, zap_protocol.pulse[i].voltage,
+		    zap_protocol.pulse[i].depth, zap_protocol.pulse[i].energy_cutoff, zap_protocol.pulse[i].interval_us,
+		    zap_protocol.pulse[i].width_us );
+	} else if(strcmp(token, "stats") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "reset") == 0) {
+	    stats_reset();
+	  } else if(strcmp(token, "dump") == 0) {
+	    unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+	    tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, "zappy-stats", (void *)&zap_stats, sizeof(zap_stats));
+	  } else {
+	    stats_print(strcmp(token, "wells") == 0);
+	  }
+	} else if(strcmp(token, "trace") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "clear") == 0) {
+	    trace_clear();
+	  } else if(strcmp(token, "dump") == 0) {
+	    unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+	    tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, "zappy-trace", (void *)&trace, sizeof(trace));
+	  } else {
+	    trace_print(*token ? strtoul(token, NULL, 0) : 32);
+	  }
+	} else if(strcmp(token, "profile") == 0) {
+	  token = get_token(&str);
+	  if(strcmp(token, "start") == 0) {
+	    profile_start(strtoul(get_token(&str), NULL, 0));
+	  } else if(strcmp(token, "stop") == 0) {
+	    profile_stop();
+	  } else if(strcmp(token, "dump") == 0) {
+	    unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+	    tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, "zappy-profile", (void *)&profile, sizeof(profile));
+	  }
+	  printf( "Profiler %s at %d Hz: %d samples, %d outside .text, %d bytes per bucket\n",
+		  profile_running() ? "running" : "stopped", profile.rate_hz, profile.samples, profile.outside,
+		  1 << profile.shift );
+	} else if(strcmp(token, "arc") == 0) {
+	  token = get_token(&str);
+	  if( *token ) {
+	    // slopes are converted to code differences on the paths the detector watches: delta follows the slow path
+	    uint32_t ma = strtoul(token, NULL, 0);
+	    uint32_t v = strtoul(get_token(&str), NULL, 0);
+	    uint32_t holdoff = strtoul(get_token(&str), NULL, 0);
+	    uint32_t mv = ma_to_mv(ma);
+	    uint16_t slope = 0, vslope = 0;
+	    if( ma != 0 ) {
+	      slope = mv_to_adc_code(mv > 1000000 ? 1000000 : mv, ADC_SLOW) - mv_to_adc_code(0, ADC_SLOW);
+	      if( slope == 0 )
+		slope = 1;
+	    }
+	    if( v != 0 ) {
+	      vslope = mv_to_adc_code(v > 1000 ? 1000000 : v * 1000, ADC_FAST) - mv_to_adc_code(0, ADC_FAST);
+	      if( vslope == 0 )
+		vslope = 1;
+	    }
+	    if( (slope || vslope) && holdoff == 0 ) {
+	      // with no holdoff the inrush edge itself trips the detector on every pulse
+	      printf( "Arc slope detector needs a holdoff of at least 1 sample : zerr\n" );
+	    } else {
+	      zappio_arc_slope_write(slope);
+	      zappio_arc_vslope_write(vslope);
+	      zappio_arc_holdoff_write(holdoff > 0xFFFF ? 0xFFFF : holdoff);
+	    }
+	  }
+	  printf( "Arc slope detector: delta %d codes/sample, fast path %d codes/sample, holdoff %d samples\n",
+		  zappio_arc_slope_read(), zappio_arc_vslope_read(), zappio_arc_holdoff_read() );
 	} else if(strcmp(token, "energy") == 0) {
 	  // readout energy accumulated, in hex, formatted for easy python telnetlib parsing
 	    printf( "\n0x%02x%08x : energy\n", (unsigned int) (monitor_energy_accumulator_read() >> 32),
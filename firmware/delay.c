@@ -10,25 +10,17 @@
 #include <console.h>
 #include <hw/flags.h>
 #include "delay.h"
+#include "systime.h"
 
 void delay_ms(int ms) {
-  int timer;
+  uint64_t deadline = systime_deadline_ms(ms);
 
-  elapsed(&timer, -1); // initialize the timer
-  while( !elapsed(&timer, (CONFIG_CLOCK_FREQUENCY / 1000) * ms) )
+  while( !systime_expired(deadline) )
     ;
 }
 
+// kept for callers that predate delay_ms() taking any length
 void delay(int ms) {
-  int loops, i;
-  int remainder;
-
-  loops = ms / 500;
-  remainder = ms % 500;
-
-  for( i = 0; i < loops; i++ ) {
-    delay_ms(500);
-  }
-  delay_ms(remainder);
+  delay_ms(ms);
 }
 
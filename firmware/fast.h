@@ -0,0 +1,17 @@
+#ifndef __FAST_H
+#define __FAST_H
+
+// __fast puts a function in the .fast section, which the linker script runs from the on-chip SRAM below the stack.
+// main() copies it there before interrupts are enabled. Meant for the handful of hot paths (interrupts, the network
+// data path, the zap poll loops): grouped in one small address range, they stop evicting each other from the
+// direct-mapped icache. Builds with USE_FAST=no leave everything in .text, for comparing the two
+#ifdef FAST_SRAM
+#define __fast __attribute__((section(".fast")))
+#else
+#define __fast
+#endif
+
+// __sram is in sram whatever USE_FAST says, for the few lines that have to keep running while main_ram is rewritten
+#define __sram __attribute__((section(".fast")))
+
+#endif /* __FAST_H */
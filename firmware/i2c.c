@@ -7,6 +7,7 @@
 #include <stdio.h>
 
 #include "i2c.h"
+#include "trace.h"
 
 static int i2c_tip_wait(int timeout);
 
@@ -87,8 +88,11 @@ int i2c_master(unsigned char addr, uint8_t *txbuf, int txbytes, uint8_t *rxbuf,
   }
 
   /// read half
-  if( rxbytes == 0 || rxbuf == NULL )
+  if( rxbytes == 0 || rxbuf == NULL ) {
+    if( ret )
+      trace_event(TRACE_I2C_ERROR, addr, ret);
     return ret;
+  }
   
   i2c_txr_write( addr << 1 | 1 ); // LSB 1 = reading
   i2c_command_write( I2C_CMD_MASK_STA | I2C_CMD_MASK_WR );
@@ -107,5 +111,7 @@ int i2c_master(unsigned char addr, uint8_t *txbuf, int txbytes, uint8_t *rxbuf,
     i++;
   }
 
+  if( ret )
+    trace_event(TRACE_I2C_ERROR, addr, ret);
   return ret;
 }
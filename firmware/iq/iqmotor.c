@@ -23,6 +23,7 @@
 #include "iqmotor.h"
 #include "../motor.h"
 #include "../delay.h"
+#include "../systime.h"
 
 static struct iqMotor motor_storage;
 static struct iqMotor *motor;
@@ -31,8 +32,39 @@ static struct mta_object iq_mta;
 static struct pmc_object iq_pmc;
 static struct CommInterface_storage iq_pmc_com;
 
+// requests in flight on the motor UART. The motor answers in order, so this is a small FIFO;
+// replies are matched against it by type/sub id as the PacketFinder hands them up.
+typedef struct iq_request {
+  uint8_t what;
+  uint64_t deadline;      // systime after which the request is given up on
+  iq_callback callback;
+} iq_request;
+
+typedef struct iq_value_id {
+  uint8_t type_idn;
+  uint8_t sub_idn;
+} iq_value_id;
+
+#define kTypeTemperatureMonitorUc 73
+#define kSubUcTemp 0
+
+static const iq_value_id iq_values[IQ_NUM_VALUES] = {
+  {kTypeAngleMotorControl, kSubObsAngularDisplacement}, // IQ_ANGLE
+  {kTypePowerMonitor,      kSubAmps},                   // IQ_AMPS
+  {kTypeTemperatureMonitorUc, kSubUcTemp},              // IQ_TEMP
+};
+
+static struct CommInterface_storage iq_async_com;
+static iq_request inflight[IQ_MAX_INFLIGHT];
+static int inflight_head;
+static int inflight_count;
+static float latest[IQ_NUM_VALUES];
+static uint32_t latest_seq[IQ_NUM_VALUES];
+static uint8_t refresh_mask;
+static uint8_t refresh_next;
+
 size_t write(const void *buf, size_t count);
-size_t read(const void *buf, size_t count);
+static float iq_wait(uint8_t what);
 
 void iqCreateMotor(void) {
   // basic storage allocation
@@ -53,6 +85,12 @@ void iqCreateMotor(void) {
   
   motor->pmc = &iq_pmc;
   pmc_init(motor->pmc, motor->iq_pmc_com, 0);
+
+  // async client state
+  CommInterface_init(&iq_async_com);
+  inflight_head = 0;
+  inflight_count = 0;
+  refresh_mask = 0;
 }
 
 
@@ -78,59 +116,22 @@ void iqCreateMotor(void) {
 }
 
 
- float iqReadAngle( void ) {
-  // This buffer is for passing around messages.
-  uint8_t communication_buffer_in[IQ_BUFLEN];
+ int iqSetBrake( void ) {
   uint8_t communication_buffer_out[IQ_BUFLEN];
-  // Stores length of message to send or receive
   uint8_t communication_length_out;
-  uint16_t communication_length_rx;
-
-  float angle;
-  int got_value = 0;
 
-  ///////////// READ THE INPUT CONTROLLER
-  // Generate the set messages
-  mta_get(motor->mta, kSubObsAngularDisplacement); //  motor->mta_client->obs_angular_displacement_.get(*(motor->iq_com)); // get the angular displacement
-
-  // Grab outbound messages in the com queue, store into buffer
-  // If it transferred something to communication_buffer...
+  mta_set(motor->mta, kSubCtrlBrake);
   if(CommInterface_GetTxBytes(motor->iq_com, communication_buffer_out, &communication_length_out)) {
     write(communication_buffer_out, communication_length_out);
+    return 0;
   } else {
-    return -1; // should be NAN...
-  }
-  
-  delay(2); // delay 2ms for serial data to transmit data...
-  
-  // Reads however many bytes are currently available
-  communication_length_rx = read(communication_buffer_in, IQ_BUFLEN);
-  
-  // Puts the recently read bytes into com's receive queue
-  CommInterface_SetRxBytes(motor->iq_com, communication_buffer_in, communication_length_rx);
-  
-  uint8_t *rx_data; // temporary pointer to received type+data bytes
-  uint8_t rx_length; // number of received type+data bytes
-  // while we have message packets to parse
-  while(CommInterface_PeekPacket(motor->iq_com, &rx_data, &rx_length)) {
-    // Share that packet with all client objects
-    //    motor->mta_client->ReadMsg(*(motor->iq_com), rx_data, rx_length);
-    CommInterface_ReadMsg_Mta(motor->mta, rx_data, rx_length);
-    
-    // Once we're done with the message packet, drop it
-    CommInterface_DropPacket(motor->iq_com);
-    if( !got_value ) {
-      angle = motor->mta->data.data.f;
-      got_value = 1;
-    }
+    return 1;
   }
+}
 
-  //  if( motor->mta_client->obs_angular_displacement_.IsFresh() ) {
-  mta_get_reply(motor->mta);
-  //angle = motor->mta->data.data.f; // we could dispatch on type, but in this case, we "just know"
-  //  }
-    
-  return angle;
+
+ float iqReadAngle( void ) {
+  return iq_wait(IQ_ANGLE);
 }
 
  void iqSetAngle( float target_angle, unsigned long travel_time_ms ) {
@@ -171,67 +172,7 @@ void iqSetAngleDelta( float target_angle_delta, unsigned long travel_time_ms ) {
 ///////// BEGIN PMC SECTION
 
 float iqReadAmps( void ) {
-  // This buffer is for passing around messages.
-  uint8_t communication_buffer_in[IQ_BUFLEN];
-  // Stores length of message to send
-  uint8_t communication_length_in;
-  // storel length of messages received
-  uint16_t communication_length_rx;
-
-  float amps;
-  int got_value = 0;
-
-  /*
-  memset(&iq_pmc, 0, sizeof(iq_pmc));
-  memset(&iq_pmc_com, 0, sizeof(iq_pmc));
-  motor->iq_pmc_com = &iq_pmc_com;
-  CommInterface_init(motor->iq_pmc_com);
-  
-  motor->pmc = &iq_pmc;
-  pmc_init(motor->pmc, motor->iq_pmc_com, 0);
-  */
-  
-  ///////////// READ THE INPUT CONTROLLER
-  // Generate the set messages
-  pmc_get(motor->pmc, kSubAmps); 
-
-  // Grab outbound messages in the com queue, store into buffer
-  // If it transferred something to communication_buffer...
-  if(CommInterface_GetTxBytes(motor->iq_pmc_com, communication_buffer_in, &communication_length_in)) {
-    write(communication_buffer_in, communication_length_in);
-  } else {
-    return -1; // should be NAN...
-  }
-  
-  delay(2); // delay 2ms for serial data to transmit data...
-  
-  // Reads however many bytes are currently available
-  communication_length_rx = read(communication_buffer_in, IQ_BUFLEN);
-  //printf( "read length: %d\n", communication_length_rx );
-
-  // Puts the recently read bytes into com's receive queue
-  CommInterface_SetRxBytes(motor->iq_pmc_com, communication_buffer_in, communication_length_rx);
-  
-  uint8_t *rx_data; // temporary pointer to received type+data bytes
-  uint8_t rx_length; // number of received type+data bytes
-  // while we have message packets to parse
-  while(CommInterface_PeekPacket(motor->iq_pmc_com, &rx_data, &rx_length)) {
-    // Share that packet with all client objects
-    CommInterface_ReadMsg_Pmc(motor->pmc, rx_data, rx_length);
-    
-    // Once we're done with the message packet, drop it
-    CommInterface_DropPacket(motor->iq_pmc_com);
-    if( !got_value ) {  // some weird bug causes multiple returns, and the later ones are bogus
-      amps = motor->pmc->data.data.f;
-      got_value = 1;
-    }
-    // printf( "dbg amps: %dmA\n", (int) (motor->pmc->data.data.f * 1000.0) );
-  }
-
-  pmc_get_reply(motor->pmc);
-  //  amps = motor->pmc->data.data.f; // we could dispatch on type, but in this case, we "just know"
-    
-  return amps;
+  return iq_wait(IQ_AMPS);
 }
 
 size_t write(const void *buf, size_t count) {
@@ -247,25 +188,191 @@ size_t write(const void *buf, size_t count) {
   return count;
 }
 
-size_t read(const void *buf, size_t count) {
-  int i = 0;
-  int timeout = 0;
-  char *rbuf = (char *)buf;
 
-  //  printf("motor read: ");
-  for( i = 0; i < count; i++ ) {
-    if( motor_read_nonblock() )
-      rbuf[i] = motor_read();
-    else {
-      timeout++;
-      if( timeout > 100 ) {
-	//printf( "read() timeout\n" );
-	break;
-      }
-    }
-    //    printf( "%02x ", rbuf[i] );
+///////// BEGIN ASYNC SECTION
+
+// push whatever the async com queue has built out to the motor UART without waiting for it to drain
+static void iq_flush(void) {
+  uint8_t communication_buffer_out[IQ_BUFLEN];
+  uint8_t communication_length_out;
+  int i;
+
+  if(CommInterface_GetTxBytes(&iq_async_com, communication_buffer_out, &communication_length_out)) {
+    for( i = 0; i < communication_length_out; i++ )
+      motor_write(communication_buffer_out[i]);
+  }
+}
+
+static int iq_inflight(uint8_t what) {
+  int i;
+
+  for( i = 0; i < inflight_count; i++ ) {
+    if( inflight[(inflight_head + i) % IQ_MAX_INFLIGHT].what == what )
+      return 1;
+  }
+  return 0;
+}
+
+int iqRequest( uint8_t what, iq_callback callback ) {
+  uint8_t tx_msg[2];
+  iq_request *req;
+
+  if( what >= IQ_NUM_VALUES || inflight_count >= IQ_MAX_INFLIGHT )
+    return 1;
+
+  tx_msg[0] = iq_values[what].sub_idn;
+  tx_msg[1] = (0 << 2) | kGet; // obj_idn 0, high six | low two
+  CommInterface_SendPacket(&iq_async_com, iq_values[what].type_idn, tx_msg, 2);
+  iq_flush();
+
+  req = &inflight[(inflight_head + inflight_count) % IQ_MAX_INFLIGHT];
+  req->what = what;
+  req->callback = callback;
+  req->deadline = systime_deadline_ms(IQ_REQUEST_TIMEOUT_MS);
+  inflight_count++;
+  
+  return 0;
+}
+
+static void iq_dispatch(uint8_t *rx_data, uint8_t rx_length) {
+  uint8_t what;
+  float value;
+  int i, idx;
+  iq_callback callback = NULL;
+
+  if( rx_length != 3 + sizeof(float) )
+    return;
+  if( (rx_data[2] & 0b00000011) != kReply )
+    return;
+
+  for( what = 0; what < IQ_NUM_VALUES; what++ ) {
+    if( iq_values[what].type_idn == rx_data[0] && iq_values[what].sub_idn == rx_data[1] )
+      break;
+  }
+  if( what == IQ_NUM_VALUES )
+    return;
+
+  // retire the matching request; anything queued ahead of it was lost on the wire. A reply nobody is waiting
+  // for (a duplicate, or the angle readback iqSetAngle queues) is dropped so latest_seq only counts real answers
+  for( i = 0; i < inflight_count; i++ ) {
+    idx = (inflight_head + i) % IQ_MAX_INFLIGHT;
+    if( inflight[idx].what == what )
+      break;
+  }
+  if( i == inflight_count )
+    return;
+  callback = inflight[idx].callback;
+  inflight_head = (idx + 1) % IQ_MAX_INFLIGHT;
+  inflight_count -= i + 1;
+
+  memcpy(&value, &rx_data[3], sizeof(float));
+  latest[what] = value;
+  latest_seq[what]++;
+
+  if( callback )
+    callback(what, value);
+}
+
+void iqService( void ) {
+  uint8_t communication_buffer_in[IQ_BUFLEN];
+  uint16_t communication_length_rx = 0;
+  uint8_t *rx_data;
+  uint8_t rx_length;
+  uint8_t i, what;
+
+  // take only what has already arrived, never wait on the UART
+  while( motor_read_nonblock() && communication_length_rx < IQ_BUFLEN )
+    communication_buffer_in[communication_length_rx++] = motor_read();
+  CommInterface_SetRxBytes(&iq_async_com, communication_buffer_in, communication_length_rx);
+  
+  while(CommInterface_PeekPacket(&iq_async_com, &rx_data, &rx_length)) {
+    iq_dispatch(rx_data, rx_length);
+    CommInterface_DropPacket(&iq_async_com);
+  }
+
+  // expire the oldest request if the motor never answered it
+  if( inflight_count > 0 && systime_expired(inflight[inflight_head].deadline) ) {
+    inflight_head = (inflight_head + 1) % IQ_MAX_INFLIGHT;
+    inflight_count--;
+  }
+
+  // keep the background refresh set in flight, round robin
+  for( i = 0; i < IQ_NUM_VALUES && refresh_mask && inflight_count < IQ_MAX_INFLIGHT; i++ ) {
+    what = refresh_next;
+    refresh_next = (refresh_next + 1) % IQ_NUM_VALUES;
+    if( (refresh_mask & (1 << what)) && !iq_inflight(what) )
+      iqRequest(what, NULL);
+  }
+}
+
+uint8_t iqRefresh( uint8_t mask ) {
+  uint8_t old = refresh_mask;
+  
+  refresh_mask = mask;
+  return old;
+}
+
+float iqLatest( uint8_t what ) {
+  return latest[what];
+}
+
+uint32_t iqLatestSeq( uint8_t what ) {
+  return latest_seq[what];
+}
+
+// blocking read built on the async queue: returns as soon as a fresh reply lands instead of after a fixed delay
+// returns 0 if a fresh value arrived, 1 on timeout
+static int iq_wait_fresh(uint8_t what) {
+  uint32_t seq = latest_seq[what];
+  uint64_t deadline = systime_deadline_ms(IQ_REQUEST_TIMEOUT_MS);
+
+  while( !iq_inflight(what) && iqRequest(what, NULL) )
+    iqService(); // queue is full of other requests, let them drain
+  
+  while( latest_seq[what] == seq ) {
+    iqService();
+    if( systime_expired(deadline) )
+      return 1;
   }
-  //  printf("\n");
-  return (size_t) i;
+  return 0;
 }
 
+static float iq_wait(uint8_t what) {
+  if( iq_wait_fresh(what) )
+    return -1; // should be NAN...
+  return latest[what];
+}
+
+
+///////// BEGIN SERIAL INTERFACE SECTION
+
+#define kTypeSerialInterface 16
+#define kSubBaudRate 0
+
+static void iq_send_baud(uint32_t baud) {
+  uint8_t tx_msg[2 + sizeof(uint32_t)];
+
+  tx_msg[0] = kSubBaudRate;
+  tx_msg[1] = (0 << 2) | kSet; // obj_idn 0, high six | low two
+  memcpy(&tx_msg[2], &baud, sizeof(uint32_t));
+  CommInterface_SendPacket(&iq_async_com, kTypeSerialInterface, tx_msg, 2 + sizeof(uint32_t));
+  iq_flush();
+}
+
+int iqNegotiateBaud( uint32_t baud ) {
+  // the new rate is not saved on the motor, so a power cycle always brings it back to MOTOR_BOOT_BAUD
+  if( iq_wait_fresh(IQ_ANGLE) )
+    return 1; // motor isn't answering at the boot rate, leave everything alone
+
+  iq_send_baud(baud);
+  motor_set_baud(baud);
+  inflight_count = 0; // anything in flight was sent at the old rate
+  if( iq_wait_fresh(IQ_ANGLE) == 0 )
+    return 0;
+
+  // no answer at the new rate: ask the motor to go back (in case it did switch) and fall back ourselves
+  iq_send_baud(MOTOR_BOOT_BAUD);
+  motor_set_baud(MOTOR_BOOT_BAUD);
+  inflight_count = 0;
+  return 1;
+}
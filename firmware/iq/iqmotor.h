@@ -36,6 +36,10 @@ typedef struct iqMotor {
 // Arguments: motor object
  int iqSetCoast( void );
 
+// Set a motor to "brake" mode, shorting the windings to stop it as quickly as possible
+// Arguments: motor object
+ int iqSetBrake( void );
+
 // read the angle of a motor
 // Arguments: motor_obj (already initialized with prior call to createIqMotor)
 // Returns: current angle of motor, in radians
@@ -56,5 +60,35 @@ typedef struct iqMotor {
 
 float iqReadAmps( void );
 
+// switch the motor link to a faster baud rate via the serial interface client
+// Returns: 0 if the motor answers at the new rate, 1 if we fell back to MOTOR_BOOT_BAUD
+int iqNegotiateBaud( uint32_t baud );
+
+// Asynchronous client: requests are queued on the motor UART and matched to replies in iqService(),
+// which must be called regularly (the main loop does). Latest values are cached as they arrive.
+#define IQ_ANGLE 0   // radians
+#define IQ_AMPS  1   // amps
+#define IQ_TEMP  2   // motor controller temperature, C
+#define IQ_NUM_VALUES 3
+
+#define IQ_MAX_INFLIGHT 4
+#define IQ_REQUEST_TIMEOUT_MS 10
+
+typedef void (*iq_callback)(uint8_t what, float value);
+
+// queue a read of value 'what'; callback (may be NULL) runs from iqService() when the reply lands
+// Returns: 0 if queued, 1 if too many requests are already in flight
+int iqRequest( uint8_t what, iq_callback callback );
+
+// parse arrived replies, retire timed out requests and keep the refresh set in flight
+void iqService( void );
+
+// set of values to keep refreshing in the background, as a mask of (1 << IQ_*); returns the previous mask
+uint8_t iqRefresh( uint8_t mask );
+
+// most recent cached value, and a counter that increments each time it is updated
+float iqLatest( uint8_t what );
+uint32_t iqLatestSeq( uint8_t what );
+
 #define IQ_BUFLEN 1024   // length of IQ message buffer
 
@@ -2,8 +2,11 @@
 #include <irq.h>
 #include <uart.h>
 
+#include "profile.h"
+#include "fast.h"
+
 void isr(void);
-void isr(void)
+__fast void isr(void)
 {
 	unsigned int irqs;
 
@@ -15,5 +18,8 @@ void isr(void)
 	if(irqs & (1 << MOTOR_INTERRUPT)) {
 	  motor_isr();
 	}
+	if(irqs & (1 << TIMER1_INTERRUPT)) {
+	  profile_isr();
+	}
 
 }
@@ -21,5 +21,14 @@ then
     exit 1
 fi
 
-sudo openocd -c 'set BSCAN_FILE bscan_spi_xc7s50.bit' -c 'set FIRMWARE_FILE /tmp/ufirmware.upl' -f cl-firmware.cfg
+# an XIP build also has code that runs straight from flash at 0x800000 (xip_offset in zappy.py); a firmware-xip.bin
+# older than firmware.elf is left over from an earlier XIP build, and the firmware would refuse it anyway
+XIP_FILE=""
+if [ -f ../../firmware/firmware-xip.bin ] && ! [ ../../firmware/firmware.elf -nt ../../firmware/firmware-xip.bin ]
+then
+    ./mkzappyimg -x --output /tmp/ufirmware-xip.upl ../../firmware/firmware-xip.bin
+    XIP_FILE=/tmp/ufirmware-xip.upl
+fi
+
+sudo openocd -c 'set BSCAN_FILE bscan_spi_xc7s50.bit' -c 'set FIRMWARE_FILE /tmp/ufirmware.upl' -c "set XIP_FILE \"$XIP_FILE\"" -f cl-firmware.cfg
 sudo ./reboot.sh
@@ -11,7 +11,10 @@
 
 #include "microudp.h"
 #include "../ethernet.h"
+#include "../systime.h"
 #include "tftp.h"
+#include "../trace.h"
+#include "../fast.h"
 
 #ifdef LIBUIP
 #include <time.h>
@@ -201,7 +204,7 @@ void uip_log(char *msg)
 
 #endif // LIBUIP
 
-static void send_packet(void)
+__fast static void send_packet(void)
 {
 	/* wait buffer to be available */
 	while(!(ethmac_sram_reader_ready_read()));
@@ -363,10 +366,11 @@ int microudp_arp_resolve(unsigned int ip)
 		}
 	}
 
+	trace_event(TRACE_ARP_MISS, 0, ip);
 	return 0;
 }
 
-static unsigned short ip_checksum(unsigned int r, void *buffer, unsigned int length, int complete)
+__fast static unsigned short ip_checksum(unsigned int r, void *buffer, unsigned int length, int complete)
 {
 	unsigned char *ptr;
 	unsigned int i;
@@ -402,7 +406,7 @@ struct pseudo_header {
 	unsigned short length;
 } __attribute__((packed));
 
-int microudp_send(unsigned short src_port, unsigned short dst_port, unsigned int length)
+__fast int microudp_send(unsigned short src_port, unsigned short dst_port, unsigned int length)
 {
 	struct pseudo_header h;
 	unsigned int r;
@@ -504,7 +508,7 @@ int microicmp_reply(unsigned short id, unsigned short seq, char *stuff, unsigned
 static udp_callback rx_callback;
 
 // returns 0 if we can process
-static int process_ip(void)
+__fast static int process_ip(void)
 {
 	if(rxlen < (sizeof(struct ethernet_header)+sizeof(struct udp_frame))) return 1;
 	struct udp_frame *udp_ip = &rxbuffer->frame.contents.udp;
@@ -548,7 +552,7 @@ void microudp_set_callback(udp_callback callback)
 }
 
 // returns 0 if frame can be processed by this function
-static int process_frame(void)
+__fast static int process_frame(void)
 {
   //	flush_cpu_dcache();
 #ifdef DEBUG_MICROUDP_RX
@@ -648,7 +652,7 @@ void microudp_start(const unsigned char *macaddr, unsigned char ip0, unsigned ch
 	
 }
 
-void microudp_service(void)
+__fast void microudp_service(void)
 {
 #ifdef LIBUIP
 	int i;
@@ -719,12 +723,9 @@ void microudp_service(void)
 
 static void busy_wait(unsigned int ds)
 {
-	timer0_en_write(0);
-	timer0_reload_write(0);
-	timer0_load_write(CONFIG_CLOCK_FREQUENCY/10*ds);
-	timer0_en_write(1);
-	timer0_update_value_write(1);
-	while(timer0_value_read()) timer0_update_value_write(1);
+	uint64_t deadline = systime_deadline_ms(100*ds); /* leaves timer0 alone, so time_init() order doesn't matter */
+
+	while(!systime_expired(deadline));
 }
 
 void eth_init(void)
@@ -3,6 +3,8 @@
 
 #include <net/microudp.h>
 #include "tftp.h"
+#include "../trace.h"
+#include "../fast.h"
 
 enum {
 	TFTP_RRQ	= 1,	/* Read request */
@@ -10,27 +12,38 @@ enum {
 	TFTP_DATA	= 3,	/* Data */
 	TFTP_ACK	= 4,	/* Acknowledgment */
 	TFTP_ERROR	= 5,	/* Error */
+	TFTP_OACK	= 6,	/* Option acknowledgment (RFC 2347) */
 };
 
-#define	BLOCK_SIZE	512	/* block size in bytes */
+#define	BLOCK_SIZE	512	/* block size in bytes, unless tftp_get negotiates another */
+#define	ERROR_OPTIONS	8	/* error code of a server that refuses the options */
 
+#define	STR(x)		#x
+#define	XSTR(x)		STR(x)
 
-static int format_request(uint8_t *buf, uint16_t op, const char *filename)
+static uint8_t *put_string(uint8_t *buf, const char *s)
 {
-	int len = strlen(filename);
+	int len = strlen(s) + 1;
+
+	memcpy(buf, s, len);
+	return buf + len;
+}
+
+static int format_request(uint8_t *buf, uint16_t op, const char *filename, int options)
+{
+	uint8_t *start = buf;
 
 	*buf++ = op >> 8; /* Opcode */
 	*buf++ = op;
-	memcpy(buf, filename, len);
-	buf += len;
-	*buf++ = 0x00;
-	*buf++ = 'o';
-	*buf++ = 'c';
-	*buf++ = 't';
-	*buf++ = 'e';
-	*buf++ = 't';
-	*buf++ = 0x00;
-	return 9+strlen(filename);
+	buf = put_string(buf, filename);
+	buf = put_string(buf, "octet");
+	if(options) {
+		buf = put_string(buf, "blksize");
+		buf = put_string(buf, XSTR(TFTP_BLKSIZE));
+		buf = put_string(buf, "windowsize");
+		buf = put_string(buf, XSTR(TFTP_WINDOWSIZE));
+	}
+	return buf - start;
 }
 
 static int format_ack(uint8_t *buf, uint16_t block)
@@ -42,7 +55,7 @@ static int format_ack(uint8_t *buf, uint16_t block)
 	return 4;
 }
 
-static int format_data(uint8_t *buf, uint16_t block, const void *data, int len)
+__fast static int format_data(uint8_t *buf, uint16_t block, const void *data, int len)
 {
 	*buf++ = 0x00; /* Opcode: Data*/
 	*buf++ = TFTP_DATA;
@@ -56,10 +69,61 @@ static uint8_t *packet_data;
 static int total_length;
 static int transfer_finished;
 static uint8_t *dst_buffer;
+static int dst_size;
+static uint16_t last_block; /* tftp_get: last data block taken, a repeat of it is only re-acked */
 static int last_ack; /* signed, so we can use -1 */
 static uint16_t data_port;
 
-static void rx_callback(uint32_t src_ip, uint16_t src_port,
+/* tftp_get's side of the options: what the server agreed to, 512 and 1 (RFC 1350 lockstep) if it sent no OACK */
+static int started; /* an OACK or the first DATA came back, so the request needn't be sent again */
+static int options_refused; /* the server answered the options with an error; ask again without them */
+static uint16_t blksize;
+static uint16_t windowsize;
+static uint16_t window_left; /* blocks still to come in this window before it's acked */
+static int gap_acked; /* an out-of-order block was acked; the server restarts the window, so don't ack the rest */
+
+/* case-insensitive, as RFC 2347 has option names */
+static int option_is(const char *name, const char *option)
+{
+	while(*option)
+		if((*name++ | 0x20) != *option++)
+			return 0;
+	return *name == 0;
+}
+
+/* the OACK lists the options the server took, with values it may have lowered; anything else keeps its default */
+static void parse_oack(const uint8_t *p, int len)
+{
+	const uint8_t *end = p + len;
+	const char *name;
+	int value;
+
+	while(p < end) {
+		name = (const char *)p;
+		while(p < end && *p) p++;
+		if(++p >= end) return;
+		value = 0;
+		while(p < end && *p >= '0' && *p <= '9')
+			value = value*10 + *p++ - '0';
+		while(p < end && *p) p++;
+		p++;
+		if(option_is(name, "blksize") && value >= 8 && value <= TFTP_BLKSIZE)
+			blksize = value;
+		else if(option_is(name, "windowsize") && value >= 1 && value <= TFTP_WINDOWSIZE)
+			windowsize = value;
+	}
+}
+
+__fast static void send_ack(uint16_t port, uint16_t block)
+{
+	int length;
+
+	packet_data = microudp_get_tx_buffer();
+	length = format_ack(packet_data, block);
+	microudp_send(PORT_IN, port, length);
+}
+
+__fast static void rx_callback(uint32_t src_ip, uint16_t src_port,
     uint16_t dst_port, void *_data, unsigned int length)
 {
 	uint8_t *data = _data;
@@ -77,33 +141,74 @@ static void rx_callback(uint32_t src_ip, uint16_t src_port,
 		last_ack = block;
 		return;
 	}
-	if(block < 1) return;
+	if(opcode == TFTP_OACK) { /* Options taken: ack block 0 and the data starts */
+		if(started) { /* a repeat: our ack of it went missing */
+			if(total_length == 0) send_ack(src_port, 0);
+			return;
+		}
+		parse_oack(data + 2, length - 2);
+		started = 1;
+		data_port = src_port;
+		window_left = windowsize;
+		send_ack(src_port, 0);
+		return;
+	}
 	if(opcode == TFTP_DATA) { /* Data */
-		length -= 4;
-		offset = (block-1)*BLOCK_SIZE;
-		for(i=0;i<length;i++)
-			dst_buffer[offset+i] = data[i+4];
-		total_length += length;
-		if(length < BLOCK_SIZE)
-			transfer_finished = 1;
-
-		packet_data = microudp_get_tx_buffer();
-		length = format_ack(packet_data, block);
-		microudp_send(PORT_IN, src_port, length);
+		if(block < 1) return;
+		if(started && src_port != data_port) return; /* a stray from an earlier transfer */
+		if(!started) { /* no OACK, so an RFC 1350 server: the transfer starts at block 1 */
+			if(block != 1) return;
+			started = 1;
+			data_port = src_port;
+			window_left = windowsize;
+		}
+		if(block == (uint16_t)(last_block + 1)) {
+			/* in order: offset by what's been taken, so the block number may wrap */
+			length -= 4;
+			offset = total_length;
+			if(offset + length > dst_size) {
+				total_length = -1;
+				transfer_finished = 1;
+				return;
+			}
+			for(i=0;i<length;i++)
+				dst_buffer[offset+i] = data[i+4];
+			total_length += length;
+			last_block = block;
+			gap_acked = 0;
+			if(length < blksize)
+				transfer_finished = 1;
+			else if(--window_left)
+				return; /* mid-window, the server doesn't wait for this one */
+		} else if(windowsize > 1 || block != last_block) {
+			/* a gap, or an old block: ack the last one in order, once, and the server goes back to it. Past
+			   lockstep that includes a repeat of the last block, or every window that follows goes out twice */
+			if(gap_acked) return;
+			gap_acked = 1;
+		}
+		/* end of window, end of file, or in lockstep a repeat of the last block because its ack was lost */
+		window_left = windowsize;
+		send_ack(src_port, last_block);
 	}
 	if(opcode == TFTP_ERROR) { /* Error */
+		if(!started && block == ERROR_OPTIONS) {
+			options_refused = 1;
+			return;
+		}
 		total_length = -1;
 		transfer_finished = 1;
 	}
 }
 
 int tftp_get(uint32_t ip, uint16_t server_port, const char *filename,
-    void *buffer)
+    void *buffer, int size)
 {
 	int len;
 	int tries;
 	int i;
+	int stalls;
 	int length_before;
+	int options = 1;
 
 	if(!microudp_arp_resolve(ip))
 		return -1;
@@ -111,36 +216,61 @@ int tftp_get(uint32_t ip, uint16_t server_port, const char *filename,
 	microudp_set_callback(rx_callback);
 
 	dst_buffer = buffer;
+	dst_size = size;
+	last_block = 0;
+	blksize = BLOCK_SIZE;
+	windowsize = 1;
+	gap_acked = 0;
+	started = 0;
+	options_refused = 0;
 
 	total_length = 0;
 	transfer_finished = 0;
 	tries = 5;
 	while(1) {
 		packet_data = microudp_get_tx_buffer();
-		len = format_request(packet_data, TFTP_RRQ, filename);
+		len = format_request(packet_data, TFTP_RRQ, filename, options);
 		microudp_send(PORT_IN, server_port, len);
 		for(i=0;i<2000000;i++) {
 			microudp_service();
-			if((total_length > 0) || transfer_finished) break;
+			if(started || transfer_finished || options_refused) break;
+		}
+		if(started || transfer_finished) break;
+		if(options_refused) { /* a plain RFC 1350 request goes out straight away */
+			options_refused = 0;
+			options = 0;
+			continue;
 		}
-		if((total_length > 0) || transfer_finished) break;
 		tries--;
 		if(tries == 0) {
+			trace_event(TRACE_TFTP_FAIL, 0, ip);
 			microudp_set_callback(NULL);
 			return -1;
 		}
+		trace_event(TRACE_TFTP_RETRY, 0, tries);
 	}
 
-	i = 12000000;
+	/* a quiet spell means the tail of a window, or the ack that ends it, went missing: ack what's here again and
+	   the server carries on from there. Six of them in a row give up, the old lockstep timeout */
+	i = 2000000;
+	stalls = 0;
 	length_before = total_length;
 	while(!transfer_finished) {
 		if(length_before != total_length) {
-			i = 12000000;
+			i = 2000000;
+			stalls = 0;
 			length_before = total_length;
 		}
 		if(i-- == 0) {
-			microudp_set_callback(NULL);
-			return -1;
+			if(++stalls == 6) {
+				trace_event(TRACE_TFTP_FAIL, last_block + 1, ip);
+				microudp_set_callback(NULL);
+				return -1;
+			}
+			trace_event(TRACE_TFTP_RETRY, last_block + 1, 6 - stalls);
+			window_left = windowsize;
+			send_ack(data_port, last_block);
+			i = 2000000;
 		}
 		microudp_service();
 	}
@@ -150,7 +280,7 @@ int tftp_get(uint32_t ip, uint16_t server_port, const char *filename,
 	return total_length;
 }
 
-int tftp_put(uint32_t ip, uint16_t server_port, const char *filename,
+__fast int tftp_put(uint32_t ip, uint16_t server_port, const char *filename,
     const void *buffer, int size)
 {
 	int len, send;
@@ -170,7 +300,7 @@ int tftp_put(uint32_t ip, uint16_t server_port, const char *filename,
 	tries = 5;
 	while(1) {
 		packet_data = microudp_get_tx_buffer();
-		len = format_request(packet_data, TFTP_WRQ, filename);
+		len = format_request(packet_data, TFTP_WRQ, filename, 0);
 		microudp_send(PORT_IN, server_port, len);
 		for(i=0;i<2000000;i++) {
 			last_ack = -1;
@@ -183,6 +313,7 @@ int tftp_put(uint32_t ip, uint16_t server_port, const char *filename,
 		tries--;
 		if(tries == 0)
 			goto fail;
+		trace_event(TRACE_TFTP_RETRY, 0, tries);
 	}
 
 send_data:
@@ -203,6 +334,7 @@ send_data:
 			}
 			if (!--tries)
 				goto fail;
+			trace_event(TRACE_TFTP_RETRY, block, tries);
 		}
 next:
 		sent += send;
@@ -214,6 +346,7 @@ next:
 	return sent;
 
 fail:
+	trace_event(TRACE_TFTP_FAIL, block, ip);
 	microudp_set_callback(NULL);
 	return -1;
 }
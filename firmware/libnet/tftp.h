@@ -7,8 +7,16 @@
 #define PORT_IN		7642
 #define TFTP_PORT_IN    PORT_IN
 
+/* tftp_get asks for these (RFC 2348 blksize, RFC 7440 windowsize) and takes whatever the server's OACK lowers them
+ * to, or 512-byte lockstep from a server that doesn't do options. 1428 keeps a DATA frame inside a 1500 byte MTU
+ * with room for a tunnel. The window is bounded by the ETHMAC's two RX slots: the copy out of a slot takes about as
+ * long as the next frame takes to arrive, so much past a few blocks a window only turns into drops */
+#define TFTP_BLKSIZE		1428
+#define TFTP_WINDOWSIZE		4
+
+/* size bounds the download: a longer file fails with -1 rather than overrunning buffer */
 int tftp_get(uint32_t ip, uint16_t server_port, const char *filename,
-    void *buffer);
+    void *buffer, int size);
 int tftp_put(uint32_t ip, uint16_t server_port, const char *filename,
     const void *buffer, int size);
 
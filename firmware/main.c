@@ -15,6 +15,11 @@
 #include "ci.h"
 #include "processor.h"
 #include "uptime.h"
+#include "systime.h"
+#include "trace.h"
+#ifdef XIP
+#include "xip.h"
+#endif
 #include "mdio.h"
 #include "version.h"
 
@@ -115,19 +120,38 @@ void telnet_hook(char c) {
 #endif
 }
   
+// the BIOS loads the whole image into main_ram; the __fast functions are linked to run from sram, so move them
+// there before anything, the ISR included, can call one
+static void fast_init(void) {
+  extern char _ffast[], _efast[], _ffast_load[];
+
+  memcpy(_ffast, _ffast_load, _efast - _ffast);
+  flush_cpu_icache();
+}
+
 int main(void) {
+  fast_init();
 #ifdef LIBUIP
   telnet_active = 0;
 #endif
   irq_setmask(0);
   irq_setie(1);
   uart_init();
+  trace_init();
 
   puts("Zappy firmware booting...\n");
+#ifdef XIP
+  // nothing past this point is safe to run if the flash half is from another build: the console itself lives there
+  if( xip_check() ) {
+    puts("Program firmware-xip.bin from this build, or rebuild with USE_XIP=no. Halted.");
+    while( 1 )
+      ;
+  }
+#endif
 
   print_version();
 
-  eth_init(); // must call before time init
+  eth_init();
 #ifdef LIBUIP
   clock_init();
 #endif
@@ -153,8 +177,10 @@ int main(void) {
   update_temperature();
 
 
+  cal_init(); // integer voltage conversions, needed before the first HV read below
+
   // fundamental hardware modes -- used by the global zap control system
-  monitor_period_write(CONFIG_CLOCK_FREQUENCY / 1000000); // shoot for 1 microsecond period
+  monitor_period_write(1); // keep every sample of the 1 MSPS stream: 1 microsecond period
   zappio_triggermode_write(0); // use hardware trigger
   zappio_override_safety_write(0); // set to 1 to bypass lockouts for testing
 
@@ -203,6 +229,10 @@ int main(void) {
   
 #ifdef MOTOR
   iqCreateMotor();
+  if( iqNegotiateBaud(MOTOR_FAST_BAUD) )
+    printf( "Motor link stays at %d baud\n", MOTOR_BOOT_BAUD );
+  else
+    printf( "Motor link running at %d baud\n", MOTOR_FAST_BAUD );
   snprintf(ui_notifications, sizeof(ui_notifications), "Homing the cams...\n");
   oled_ui();
   
@@ -212,20 +242,23 @@ int main(void) {
     snprintf(ui_notifications, sizeof(ui_notifications), "Error in homing!.\n");
   }
   oled_ui();
+  iqRefresh((1 << IQ_ANGLE) | (1 << IQ_AMPS) | (1 << IQ_TEMP)); // keep the cached motor state current
 #endif
   status_led = LED_STATUS_GREEN;
 
-  int interval;
-  elapsed(&interval, -1);
+  uint64_t temperature_due = systime_deadline_ms(500);
   
   while(1) {
-    if( elapsed(&interval, CONFIG_CLOCK_FREQUENCY / 2) ) { // twice a second update the temperature
+    if( systime_expired(temperature_due) ) { // twice a second update the temperature
       update_temperature();
+      temperature_due = systime_deadline_ms(500);
     }
-    uptime_service();
     processor_service();
     ci_service();
     microudp_service();
+#ifdef MOTOR
+    iqService();
+#endif
     oled_ui();
   }
 
@@ -55,6 +55,9 @@ void do_motor(char *token) {
     printf( "reading motor amps\n" );
     float amps = iqReadAmps();
     printf( "amps: %dmA\n", (int)(amps*1000) );
+  } else if( strcmp(token, "latest") == 0 ) {
+    printf( "angle: %d mrad, amps: %dmA, temp: %dC\n", (int)(iqLatest(IQ_ANGLE) * 1000),
+	    (int)(iqLatest(IQ_AMPS) * 1000), (int) iqLatest(IQ_TEMP) );
   } else if( strcmp(token, "coast") == 0 ) {
     iqSetCoast();
   } else {
@@ -1,6 +1,11 @@
 #ifndef __MOTOR_H
 #define __MOTOR_H
 
+#include <stdint.h>
+
+#define MOTOR_BOOT_BAUD 115200   // rate the motor powers up at
+#define MOTOR_FAST_BAUD 921600   // rate negotiated after boot
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,6 +15,7 @@ void do_motor(char *token);
 void motor_init(void);
 void motor_isr(void);
 void motor_sync(void);
+void motor_set_baud(uint32_t baud);
 
 void motor_write(char c);
 char motor_read(void);
@@ -3,19 +3,22 @@
 #include <generated/csr.h>
 #include <hw/flags.h>
 
+#include "motor.h"
+#include "delay.h"
+
 /*
  * Buffer sizes must be a power of 2 so that modulos can be computed
  * with logical AND.
  */
 
-#define UART_RINGBUFFER_SIZE_RX 128
+#define UART_RINGBUFFER_SIZE_RX 256
 #define UART_RINGBUFFER_MASK_RX (UART_RINGBUFFER_SIZE_RX-1)
 
 static char rx_buf[UART_RINGBUFFER_SIZE_RX];
 static volatile unsigned int rx_produce;
 static unsigned int rx_consume;
 
-#define UART_RINGBUFFER_SIZE_TX 128
+#define UART_RINGBUFFER_SIZE_TX 256
 #define UART_RINGBUFFER_MASK_TX (UART_RINGBUFFER_SIZE_TX-1)
 
 static char tx_buf[UART_RINGBUFFER_SIZE_TX];
@@ -91,6 +94,16 @@ void motor_write(char c)
 	irq_setmask(oldmask);
 }
 
+// reprogram the PHY baud rate; the rx idle timeout tracks it at two character times
+void motor_set_baud(uint32_t baud)
+{
+	motor_sync();
+	while(!motor_txempty_read());
+	delay_ms(1); /* let the last character leave the shift register */
+	motor_phy_tuning_word_write((uint32_t) (((uint64_t) baud << 32) / CONFIG_CLOCK_FREQUENCY));
+	motor_rx_timeout_write((CONFIG_CLOCK_FREQUENCY / baud) * 20);
+}
+
 void motor_comm_init(void)
 {
 	rx_produce = 0;
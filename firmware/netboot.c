@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <generated/csr.h>
+#include <generated/mem.h>
+#include <irq.h>
+#include <uart.h>
+#include <crc.h>
+
+#include "netboot.h"
+#include "fast.h"
+#include "delay.h"
+#include "systime.h"
+#include "ethernet.h"
+
+#include <net/microudp.h>
+#include <net/tftp.h>
+
+// Loads a new firmware over Ethernet and runs it, instead of the serial upload or a reflash. The BIOS's own netboot
+// is lockstep 512-byte TFTP with no check, so this runs from the firmware already in flash and uses its tftp_get(),
+// with the larger blocks and windows it negotiates: a 100 KB image is about 18 round trips. The image is staged in
+// the capture memory, the only other block as big as main_ram, and checked there; only then is it copied over the
+// running firmware, from sram.
+
+// copies the image over main_ram and starts it. Everything it runs has to be in sram: memcpy() and the libbase cache
+// flushes are in main_ram, under the copy, hence the volatile loop and the inline cache ops (VexRiscv's, as
+// flush_cpu_icache/dcache have them)
+__sram __attribute__((noreturn)) static void netboot_jump(const volatile uint32_t *src, uint32_t words) {
+  volatile uint32_t *dst = (volatile uint32_t *) MAIN_RAM_BASE;
+
+  while( words-- )
+    *dst++ = *src++;
+  asm volatile( ".word(0x500F)\n" ); // dcache
+  asm volatile( ".word(0x100F)\n nop\n nop\n nop\n nop\n nop\n" ); // icache
+  ((void (*)(void)) MAIN_RAM_BASE)();
+  while( 1 )
+    ;
+}
+
+int netboot(const char *filename) {
+  uint8_t *image = (uint8_t *) MONITOR_BASE;
+  unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+  uint64_t start;
+  uint32_t ms, crc;
+  int len;
+
+#ifdef XIP
+  // the staged image would be only the main_ram half: it would start against the flash half of this build, which
+  // its own xip_check() can't tell apart from a mismatch until it halts
+  printf( "Netboot: not supported by an XIP build, program firmware.bin and firmware-xip.bin instead : zerr\n" );
+  return -1;
+#endif
+  // nothing else may write the capture memory meanwhile: a free-running capture stops within its depth, 33 ms at
+  // most. A depth of the whole memory makes the read view's rotation (for circular captures) a plain rotation, the
+  // same for the writes here as for the reads, so the staged image reads back as written whatever the last capture was
+  monitor_circular_write(0);
+  delay_ms(40);
+  monitor_depth_write(MONITOR_SIZE / 4);
+
+  start = systime_now();
+  len = tftp_get(ip, DEFAULT_TFTP_SERVER_PORT, filename, image, MONITOR_SIZE);
+  ms = systime_to_ms(systime_elapsed_since(start));
+  if( len < 0 ) {
+    printf( "Netboot: tftp_get of %s failed, or longer than %d bytes : zerr\n", filename, MONITOR_SIZE );
+    return -1;
+  }
+  if( len < 8 || len - 4 > MAIN_RAM_SIZE ) {
+    printf( "Netboot: %s is %d bytes, not a firmware image for %d bytes of main_ram : zerr\n", filename, len,
+	    MAIN_RAM_SIZE );
+    return -1;
+  }
+  crc = image[len - 4] | (image[len - 3] << 8) | (image[len - 2] << 16) | ((uint32_t) image[len - 1] << 24);
+  if( crc32(image, len - 4) != crc ) {
+    printf( "Netboot: %s failed its CRC check (%08x), not started : zerr\n", filename, crc );
+    return -1;
+  }
+  printf( "Netboot: %s, %d bytes in %d ms (%d KiB/s), CRC good; starting it : zpass\n", filename, len - 4, ms,
+	  ms ? len * 1000 / ms / 1024 : 0 );
+
+  // the gateware isn't reset the way a reboot resets it, so leave the HV side safe for the new firmware's init
+  zappio_row_write(0);
+  zappio_col_write(0);
+  hvctl_ctl_write(0);
+  monitor_charge_ctl_write(0);
+  zappio_hv_engage_write(0);
+
+  uart_sync();
+  irq_setie(0);
+  irq_setmask(0);
+  netboot_jump((const volatile uint32_t *) image, (len - 4 + 3) / 4);
+}
@@ -0,0 +1,11 @@
+#ifndef __NETBOOT_H
+#define __NETBOOT_H
+
+// fast network boot: firmware.img is firmware.bin with its CRC32 appended little-endian (make builds it), served by
+// the host's tftpd. netboot() only returns if the image didn't arrive or didn't check out; the running firmware is
+// untouched until then
+#define NETBOOT_FILE "firmware.img"
+
+int netboot(const char *filename);
+
+#endif /* __NETBOOT_H */
@@ -17,6 +17,8 @@
 #include "motor.h"
 #include "plate.h"
 #include "delay.h"
+#include "systime.h"
+#include "trace.h"
 #include "ui.h"
 
 #define UNLOCKED 0
@@ -40,64 +42,111 @@ uint32_t plate_present(void) {
     return 0;
 }
 
+static int l25_is_open(void) {
+  return zappio_l25_open_read() != 0;
+}
+
+static int l25_is_closed(void) {
+  return zappio_l25_open_read() == 0;
+}
+
+static int plate_is_seated(void) {
+  return zappio_noplate_read() == 0;
+}
+
+// for moves that should run the whole trajectory: only a jam stops them early
+static int plate_never(void) {
+  return 0;
+}
+
+// issue a single trajectory to the motor, then watch the stop condition while it runs
+// returns STREAM_STOPPED if done() fired, STREAM_JAM on over-current, STREAM_TIMEOUT if the trajectory
+// ran out (plus settle time) without done() firing. The start-of-move current peak while the motor accelerates
+// sits above MOTOR_JAM_CURRENT, so the jam check is blanked for the first PLATE_JAM_BLANK_MS of the trajectory
+#define STREAM_STOPPED  1
+#define STREAM_TIMEOUT  0
+#define STREAM_JAM     -1
+static int plate_stream(float target, uint32_t travel_ms, int (*done)(void)) {
+  uint64_t deadline = systime_deadline_ms(travel_ms + PLATE_SETTLE_MS);
+  uint64_t blank = systime_deadline_ms(PLATE_JAM_BLANK_MS);
+  uint32_t amps_seq;
+  uint8_t old_refresh;
+  int ret;
+
+  if( done() )
+    return STREAM_STOPPED;
+  
+  // only motor current matters while moving, keep it streaming in the background
+  old_refresh = iqRefresh(1 << IQ_AMPS);
+  amps_seq = iqLatestSeq(IQ_AMPS);
+  iqSetAngle(target, travel_ms);
+
+  while( 1 ) {
+    if( done() ) {
+      iqSetBrake();
+      ret = STREAM_STOPPED;
+      break;
+    }
+
+    iqService();
+    if( iqLatestSeq(IQ_AMPS) != amps_seq ) {
+      amps_seq = iqLatestSeq(IQ_AMPS);
+      if( systime_expired(blank) && iqLatest(IQ_AMPS) > (MOTOR_JAM_CURRENT + coast_current) ) {
+	iqSetCoast();
+	trace_event(TRACE_MOTOR_JAM, (uint16_t) (iqLatest(IQ_AMPS) * 1000.0), (int32_t) (target * 1000.0));
+	ret = STREAM_JAM;
+	break;
+      }
+    }
+
+    if( systime_expired(deadline) ) {
+      ret = STREAM_TIMEOUT;
+      break;
+    }
+  }
+  
+  iqRefresh(old_refresh);
+  return ret;
+}
+
 uint32_t plate_home(void) {
   float cur_angle = 0.0;
-  int i;
-  float motor_current = 0.0;
+  int ret;
 
   iqSetCoast();
+  delay(PLATE_SETTLE_MS);
   coast_current = iqReadAmps();
-  delay(100);
-  coast_current = iqReadAmps();
-  delay(100);
   
   cur_angle = iqReadAngle();
-  i = 1;
-  // open the dog
-  while( zappio_l25_open_read() == 0 ) {
-    iqSetAngle(6.28 * (float) i + cur_angle, 500);
-    delay(600);
-    i++;
-    
-    motor_current = iqReadAmps();
-    if( motor_current > (MOTOR_JAM_CURRENT + coast_current) ) {
-      iqSetCoast();
-      snprintf(ui_notifications, sizeof(ui_notifications), "Home: motor open jam (%d)\n", i);
-      printf( "Homing motor open jam detected at rotation %d : zerr\n", i );
-      status_led = LED_STATUS_RED;
-      pstate = platestate_error;
-      homed = 0;
-      return 0;
-    }
+  // open the dog: spin forward until the l25 sensor reports open
+  ret = plate_stream(cur_angle + 6.28 * (float) HOME_MAX_TURNS, HOME_MAX_TURNS * HOME_TURN_MS, l25_is_open);
+  if( ret != STREAM_STOPPED ) {
+    iqSetCoast();
+    snprintf(ui_notifications, sizeof(ui_notifications), "Home: motor open %s\n", ret == STREAM_JAM ? "jam" : "timeout");
+    printf( "Homing motor open %s : zerr\n", ret == STREAM_JAM ? "jam" : "timeout" );
+    status_led = LED_STATUS_RED;
+    pstate = platestate_error;
+    homed = 0;
+    return 0;
   }
 
-  delay(100);
-  cur_angle = iqReadAngle();
-  delay(100);
+  delay(PLATE_SETTLE_MS);
   cur_angle = iqReadAngle();
-  // now slowly close it
-  i = 1;
-  while( zappio_l25_open_read() ) {
-    iqSetAngle( cur_angle - (0.1 * (float) i), 10);
-    delay(20);
-    i++;
-    
-    motor_current = iqReadAmps();
-    if( motor_current > (MOTOR_JAM_CURRENT + coast_current) ) {
-      iqSetCoast();
-      snprintf(ui_notifications, sizeof(ui_notifications), "Home: motor close jam (%d)\n", i);
-      printf( "Homing motor close jam detected at rotation %d : zerr\n", i );
-      status_led = LED_STATUS_RED;
-      pstate = platestate_error;
-      homed = 0;
-      return 0;
-    }
+  // now slowly close it, the creep rate sets how precisely we find the edge
+  ret = plate_stream(cur_angle - 6.28, (uint32_t) (6.28 / HOME_CREEP_RATE * 1000.0), l25_is_closed);
+  if( ret != STREAM_STOPPED ) {
+    iqSetCoast();
+    snprintf(ui_notifications, sizeof(ui_notifications), "Home: motor close %s\n", ret == STREAM_JAM ? "jam" : "timeout");
+    printf( "Homing motor close %s : zerr\n", ret == STREAM_JAM ? "jam" : "timeout" );
+    status_led = LED_STATUS_RED;
+    pstate = platestate_error;
+    homed = 0;
+    return 0;
   }
 
-  delay(100);
-  home_angle = iqReadAngle();
-  delay(100);
+  delay(PLATE_SETTLE_MS);
   home_angle = iqReadAngle();
+  iqSetAngle(home_angle, 0); // hold the home position
 
   homed = 1;
   pstate = platestate_unlocked;
@@ -108,8 +157,7 @@ uint32_t plate_home(void) {
 
 // lock the plate in place; returns 0 if fail, 1 if success
 uint32_t plate_lock(void) {
-  int i = 0;
-  float motor_current = 0.0;
+  int ret;
   
   telnet_tx = 1;
   if( !homed ) {
@@ -123,45 +171,39 @@ uint32_t plate_lock(void) {
   }
   
   if( plate_present() ) {
-    while( (i < PROX_FULL_STROKE) && (zappio_noplate_read() != 0) ) {
-      iqSetAngle(3.14 * (float) i + home_angle, PROX_CHECK_INTERVAL);
-      delay(PROX_CHECK_INTERVAL);
-
-      motor_current = iqReadAmps();
-      // printf( "motor current: %dmA\n", motor_current * 1000.0 );
-      if( motor_current > (MOTOR_JAM_CURRENT + coast_current) ) {
-	iqSetCoast();
-	snprintf(ui_notifications, sizeof(ui_notifications), "Lock: motor jam (%d)\n", i);
-	printf( "Motor jam detected at rotation %d : zerr\n", i );
-	status_led = LED_STATUS_RED;
-	iqSetAngle(home_angle, 1000);
-	pstate = platestate_error;
-	telnet_tx = 0;
-	return 0;
-      }
-      i++;
-    };
+    // one trajectory covering the full stroke, stopped the moment the noplate switches close
+    ret = plate_stream(3.14 * (float) PROX_FULL_STROKE + home_angle, PLATE_STROKE_MS, plate_is_seated);
+    if( ret == STREAM_JAM ) {
+      snprintf(ui_notifications, sizeof(ui_notifications), "Lock: motor jam");
+      printf( "Motor jam detected during lock : zerr\n" );
+      status_led = LED_STATUS_RED;
+      iqSetAngle(home_angle, 1000);
+      pstate = platestate_error;
+      telnet_tx = 0;
+      return 0;
+    }
 
-    snprintf(ui_notifications, sizeof(ui_notifications), "Lock: success (%d)", i);
-    printf( "Plate locked at rotation count: %d : zpass\n", i );
-    status_led = LED_STATUS_GREEN;
     stopping_angle = iqReadAngle();
+    iqSetAngle(stopping_angle, 0); // hold where the plate seated
     
-    if( i >= PROX_FULL_STROKE ) {
-      snprintf(ui_notifications, sizeof(ui_notifications), "Lock: over-rotate (%d)", i);
+    if( ret == STREAM_TIMEOUT ) {
+      snprintf(ui_notifications, sizeof(ui_notifications), "Lock: over-rotate");
       printf( "Over-rotation: plate may not be engaged fully or missing : zerr\n" );
       status_led = LED_STATUS_RED;
       pstate = platestate_warning;
       telnet_tx = 0;
       return 0;
     } else {
+      snprintf(ui_notifications, sizeof(ui_notifications), "Lock: success (%d)", (int) ((stopping_angle - home_angle) * 1000.0));
+      printf( "Plate locked at angle: %d mrad : zpass\n", (int) ((stopping_angle - home_angle) * 1000.0) );
+      status_led = LED_STATUS_GREEN;
       pstate = platestate_locked;
       telnet_tx = 0;
       return 1;
     }
   } else {
     printf( "Plate not present : zerr\n" );
-    snprintf(ui_notifications, sizeof(ui_notifications), "Lock: plate not present", i);
+    snprintf(ui_notifications, sizeof(ui_notifications), "Lock: plate not present");
     pstate = platestate_unlocked;
     status_led = LED_STATUS_RED;
     telnet_tx = 0;
@@ -170,7 +212,6 @@ uint32_t plate_lock(void) {
 }
 
 uint32_t plate_unlock(void) {
-  float motor_current = 0.0;
   float cur_angle = 0.0;
   
   telnet_tx = 1;
@@ -184,13 +225,8 @@ uint32_t plate_unlock(void) {
     }
   }
   
-  iqSetAngle(home_angle, 1000);
-  delay(1000);
-
-  motor_current = iqReadAmps();
-  if( motor_current > (MOTOR_JAM_CURRENT + coast_current) ) {
+  if( plate_stream(home_angle, PLATE_STROKE_MS, plate_never) == STREAM_JAM ) {
     // buzzpwm_enable_write(1); // sound an alarm
-    iqSetCoast();
     printf("unlock jam : zerr\n");
     snprintf(ui_notifications, sizeof(ui_notifications), "Unlock: JAM");
     status_led = LED_STATUS_RED;
@@ -1,6 +1,13 @@
 #define PROX_PRESENT_THRESH  5000
 #define PROX_FULL_STROKE  28
-#define PROX_CHECK_INTERVAL 80
+
+// streaming motion parameters: each move is one trajectory, the switches are watched while it runs
+#define PLATE_STROKE_MS  600        // travel time for the full lock stroke
+#define PLATE_SETTLE_MS  50         // extra time allowed after a trajectory before declaring a timeout
+#define HOME_MAX_TURNS   8          // full turns to search for the l25 open edge
+#define HOME_TURN_MS     250        // travel time per turn while searching
+#define HOME_CREEP_RATE  5.0        // rad/s while closing onto the l25 edge
+#define PLATE_JAM_BLANK_MS 100      // jam check is ignored this long into each trajectory, while the motor accelerates
 
 #define MOTOR_JAM_CURRENT (0.50)
 
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <generated/csr.h>
+#include <irq.h>
+
+#include "profile.h"
+#include "fast.h"
+
+// Sampling profiler. timer1 is otherwise unused, so it fires at rate_hz and the ISR bins the interrupted PC (mepc)
+// into a histogram over .text, or the smaller one over .fast. Code that runs with interrupts masked is invisible to it, and time spent in the
+// other ISRs shows up at whatever they interrupted. The host side of this is test/pcprof.py.
+
+extern char _ftext[], _etext[], _ffast[], _efast[];
+
+profile_t profile;
+static int running = 0;
+
+void profile_start(uint32_t rate_hz) {
+  uint32_t text_size = (uint32_t) (_etext - _ftext);
+  uint32_t fast_size = (uint32_t) (_efast - _ffast);
+
+  profile_stop();
+  memset(&profile, 0, sizeof(profile));
+  profile.magic = PROFILE_MAGIC;
+  profile.text_base = (uint32_t) _ftext;
+  profile.nbuckets = PROFILE_BUCKETS;
+  while( (text_size >> profile.shift) >= PROFILE_BUCKETS )
+    profile.shift++;
+  profile.fast_base = (uint32_t) _ffast;
+  profile.fast_size = fast_size;
+  while( (fast_size >> profile.fast_shift) >= PROFILE_FAST_BUCKETS )
+    profile.fast_shift++;
+  if( rate_hz == 0 || rate_hz > CONFIG_CLOCK_FREQUENCY / 1000 )
+    rate_hz = 1000; // the ISR costs a few hundred cycles, keep it well under a percent of the CPU by default
+  profile.rate_hz = rate_hz;
+
+  timer1_en_write(0);
+  timer1_reload_write(CONFIG_CLOCK_FREQUENCY / rate_hz);
+  timer1_load_write(CONFIG_CLOCK_FREQUENCY / rate_hz);
+  timer1_ev_pending_write(timer1_ev_pending_read());
+  timer1_ev_enable_write(1);
+  running = 1;
+  irq_setmask(irq_getmask() | (1 << TIMER1_INTERRUPT));
+  timer1_en_write(1);
+}
+
+void profile_stop(void) {
+  irq_setmask(irq_getmask() & ~(1 << TIMER1_INTERRUPT));
+  timer1_en_write(0);
+  timer1_ev_enable_write(0);
+  running = 0;
+}
+
+int profile_running(void) {
+  return running;
+}
+
+__fast void profile_isr(void) {
+  uint32_t pc;
+  uint16_t *slot = NULL;
+
+  __asm__ volatile ("csrr %0, mepc" : "=r"(pc));
+  profile.samples++;
+  if( pc >= profile.text_base && ((pc - profile.text_base) >> profile.shift) < PROFILE_BUCKETS )
+    slot = &profile.count[(pc - profile.text_base) >> profile.shift];
+  else if( pc >= profile.fast_base && pc - profile.fast_base < profile.fast_size )
+    slot = &profile.fast_count[(pc - profile.fast_base) >> profile.fast_shift];
+  if( slot != NULL && *slot != 0xFFFF )
+    (*slot)++;
+  else
+    profile.outside++;
+
+  timer1_ev_pending_write(1);
+}
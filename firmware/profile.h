@@ -0,0 +1,34 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+
+// sampling PC profiler: timer1 interrupts record the interrupted PC into a histogram over .text, and a second one
+// over the __fast code in sram
+#define PROFILE_BUCKETS      4096
+#define PROFILE_FAST_BUCKETS 512
+#define PROFILE_MAGIC        0x5a505232 // "ZPR2"
+
+// the TFTP dump is this struct as-is, little endian; bucket i covers text_base + (i << shift)
+typedef struct profile_t {
+  uint32_t magic;
+  uint32_t text_base;
+  uint32_t shift;     // log2 of the bytes per bucket, sized so .text fits in PROFILE_BUCKETS
+  uint32_t nbuckets;
+  uint32_t rate_hz;
+  uint32_t samples;   // every interrupt, including the ones outside .text
+  uint32_t outside;   // PC outside .text and .fast (BIOS ROM calls) or a bucket already saturated
+  uint32_t fast_base; // fast_count[i] covers fast_base + (i << fast_shift)
+  uint32_t fast_shift;
+  uint32_t fast_size; // bytes of .fast, 0 when built with USE_FAST=no
+  uint16_t count[PROFILE_BUCKETS];
+  uint16_t fast_count[PROFILE_FAST_BUCKETS];
+} profile_t;
+extern profile_t profile;
+
+void profile_start(uint32_t rate_hz);
+void profile_stop(void);
+int profile_running(void);
+void profile_isr(void);
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <console.h>
+#include <generated/csr.h>
+
+#include "script.h"
+#include "zap.h"
+#include "plate.h"
+#include "ui.h"
+#include "delay.h"
+#include "systime.h"
+#include "ethernet.h"
+
+#include <net/microudp.h>
+#include <net/tftp.h>
+
+// On-device plate scripts. Loading parses and range-checks every line up front, so a bad line is reported before
+// the plate is touched rather than halfway through it; running then steps through the list with no host in the
+// loop, one zinfo line per step so the host still sees progress. A failed step stops the run where it is: the zap
+// path has already made the HV safe, and a locked plate stays locked for whoever looks at it next.
+
+script_t script;
+
+static const char *step_names[] = {
+  "plate lock", "plate unlock", "zap", "protocol clear", "protocol add", "option", "delay",
+};
+
+static const char *option_names[] = {
+  "thermal", "sequence", "hvctl", "summary",
+};
+
+void script_clear(void) {
+  script.nsteps = 0;
+}
+
+static char *next_token(char **str) {
+  char *t;
+
+  while( **str == ' ' || **str == '\t' )
+    (*str)++;
+  t = *str;
+  while( **str && **str != ' ' && **str != '\t' )
+    (*str)++;
+  if( **str )
+    *(*str)++ = 0;
+  return t;
+}
+
+// reads up to n numeric arguments into arg; returns how many were there
+static int parse_args(char **str, uint32_t *arg, int n) {
+  int i;
+  char *t;
+
+  for( i = 0; i < n; i++ ) {
+    t = next_token(str);
+    if( !*t )
+      break;
+    arg[i] = strtoul(t, NULL, 0);
+  }
+  for( int j = i; j < n; j++ )
+    arg[j] = 0;
+  return i;
+}
+
+// appends one line of script source; blank and comment lines are fine. returns 0, or -1 with the reason printed
+int script_parse_line(char *line, int lineno) {
+  script_step s;
+  uint32_t arg[7];
+  char *p, *token;
+  int i;
+
+  for( p = line; *p; p++ ) {
+    if( *p == '#' || *p == '\r' || *p == '\n' ) {
+      *p = 0;
+      break;
+    }
+  }
+  token = next_token(&line);
+  if( !*token )
+    return 0;
+  if( script.nsteps >= SCRIPT_MAX_STEPS ) {
+    printf( "Script line %d: more than %d steps : zerr\n", lineno, SCRIPT_MAX_STEPS );
+    return -1;
+  }
+
+  memset(&s, 0, sizeof(s));
+  if( strcmp(token, "plate") == 0 ) {
+    token = next_token(&line);
+    if( strcmp(token, "lock") == 0 ) {
+      s.op = SCRIPT_LOCK;
+    } else if( strcmp(token, "unlock") == 0 ) {
+      s.op = SCRIPT_UNLOCK;
+    } else {
+      printf( "Script line %d: plate takes lock or unlock : zerr\n", lineno );
+      return -1;
+    }
+  } else if( strcmp(token, "zap") == 0 ) {
+    if( parse_args(&line, arg, 7) < 6 ) {
+      printf( "Script line %d: zap needs row, col, voltage, depth, max_current_ma, energy_cutoff : zerr\n", lineno );
+      return -1;
+    }
+    // same limits do_zap() checks, caught before the run starts
+    if( arg[0] > 4 || arg[1] > 12 || arg[2] > 1000 || arg[3] >= ZAP_MAX_DEPTH ) {
+      printf( "Script line %d: zap out of range: row %d col %d %d V %d samples : zerr\n", lineno,
+	      arg[0], arg[1], arg[2], arg[3] );
+      return -1;
+    }
+    s.op = SCRIPT_ZAP;
+    s.row = arg[0];
+    s.col = arg[1];
+    s.max_current_code = zap_max_current_code((int32_t) arg[4]);
+    s.arg[0] = arg[2];
+    s.arg[1] = arg[3];
+    s.arg[2] = arg[5];
+    s.arg[3] = arg[6];
+  } else if( strcmp(token, "protocol") == 0 ) {
+    token = next_token(&line);
+    if( strcmp(token, "clear") == 0 ) {
+      s.op = SCRIPT_PROTOCOL_CLEAR;
+    } else if( strcmp(token, "add") == 0 ) {
+      if( parse_args(&line, s.arg, 5) < 4 ) {
+	printf( "Script line %d: protocol add needs V, depth, energy_cutoff, interval_us : zerr\n", lineno );
+	return -1;
+      }
+      if( s.arg[0] > 1000 || s.arg[1] < 2 ) {
+	printf( "Script line %d: pulse out of range: %d V, %d samples : zerr\n", lineno, s.arg[0], s.arg[1] );
+	return -1;
+      }
+      s.op = SCRIPT_PROTOCOL_ADD;
+    } else {
+      printf( "Script line %d: protocol takes clear or add : zerr\n", lineno );
+      return -1;
+    }
+  } else if( strcmp(token, "delay") == 0 ) {
+    if( parse_args(&line, s.arg, 1) < 1 ) {
+      printf( "Script line %d: delay needs ms : zerr\n", lineno );
+      return -1;
+    }
+    s.op = SCRIPT_DELAY;
+  } else {
+    for( i = 0; i < (int) (sizeof(option_names) / sizeof(option_names[0])); i++ )
+      if( strcmp(token, option_names[i]) == 0 )
+	break;
+    if( i == sizeof(option_names) / sizeof(option_names[0]) ) {
+      printf( "Script line %d: %s not recognized : zerr\n", lineno, token );
+      return -1;
+    }
+    s.op = SCRIPT_OPTION;
+    s.row = i;
+    token = next_token(&line);
+    if( strcmp(token, "on") == 0 ) {
+      s.col = 1;
+    } else if( strcmp(token, "off") != 0 ) {
+      printf( "Script line %d: %s takes on or off : zerr\n", lineno, option_names[i] );
+      return -1;
+    }
+  }
+
+  script.step[script.nsteps++] = s;
+  return 0;
+}
+
+// replaces the script with filename from the host; returns the number of steps, or -1
+int script_fetch(const char *filename) {
+  static char buf[SCRIPT_FILE_MAX + 1];
+  unsigned int ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+  char *line, *end;
+  int len, lineno = 1;
+
+  script_clear();
+  len = tftp_get(ip, DEFAULT_TFTP_SERVER_PORT, filename, buf, SCRIPT_FILE_MAX);
+  if( len < 0 ) {
+    printf( "Script %s: tftp_get failed, or longer than %d bytes : zerr\n", filename, SCRIPT_FILE_MAX );
+    return -1;
+  }
+  buf[len] = 0;
+
+  for( line = buf; line < buf + len; line = end + 1, lineno++ ) {
+    end = strchr(line, '\n');
+    if( end == NULL )
+      end = buf + len;
+    *end = 0;
+    if( script_parse_line(line, lineno) ) {
+      script_clear();
+      return -1;
+    }
+  }
+  return script.nsteps;
+}
+
+static int run_step(script_step *s) {
+  zap_pulse pulse;
+
+  switch( s->op ) {
+  case SCRIPT_LOCK:
+    return plate_lock() ? 0 : -1;
+  case SCRIPT_UNLOCK:
+    return plate_unlock() ? 0 : -1;
+  case SCRIPT_ZAP:
+    return do_zap(s->row, s->col, s->arg[0], s->arg[1], s->max_current_code, s->arg[2], s->arg[3]) ? -1 : 0;
+  case SCRIPT_PROTOCOL_CLEAR:
+    zap_protocol.npulses = 0;
+    return 0;
+  case SCRIPT_PROTOCOL_ADD:
+    if( zap_protocol.npulses >= PROTOCOL_MAX_PULSES ) {
+      printf( "Protocol is full at %d pulses : zerr\n", PROTOCOL_MAX_PULSES );
+      return -1;
+    }
+    pulse.voltage = s->arg[0];
+    pulse.depth = s->arg[1];
+    pulse.energy_cutoff = s->arg[2];
+    pulse.interval_us = s->arg[3];
+    pulse.width_us = s->arg[4];
+    zap_protocol.pulse[zap_protocol.npulses++] = pulse;
+    return 0;
+  case SCRIPT_OPTION:
+    if( s->row == SCRIPT_OPT_THERMAL )
+      zap_thermal = s->col;
+    else if( s->row == SCRIPT_OPT_SEQUENCE )
+      zap_sequenced = s->col;
+    else if( s->row == SCRIPT_OPT_HVCTL )
+      zap_hvctl = s->col;
+    else
+      zap_summary_only = s->col;
+    return 0;
+  case SCRIPT_DELAY:
+    delay_ms(s->arg[0]);
+    return 0;
+  }
+  return -1;
+}
+
+// runs the loaded script to the end, or to the first failed step; any key on the serial console stops it between
+// steps. returns 0 if every step ran
+int script_run(void) {
+  uint64_t start = systime_now(), step_start;
+  int i, ret = 0;
+
+  for( i = 0; i < script.nsteps; i++ ) {
+    if( readchar_nonblock() ) {
+      readchar();
+      telnet_tx = 1;
+      printf( "Script stopped by the console before step %d : zerr\n", i + 1 );
+      ret = -1;
+      break;
+    }
+    step_start = systime_now();
+    ret = run_step(&script.step[i]);
+    telnet_tx = 1; // the zap and plate paths drop it when they finish
+    printf( "Script step %d/%d: %s %s in %d ms : zinfo\n", i + 1, script.nsteps, step_names[script.step[i].op],
+	    ret ? "failed" : "done", systime_to_ms(systime_elapsed_since(step_start)) );
+    if( ret )
+      break;
+  }
+
+  if( ret )
+    printf( "Script stopped at step %d of %d : zerr\n", i + 1, script.nsteps );
+  else
+    printf( "Script of %d steps finished in %d ms : zpass\n", script.nsteps, systime_to_ms(systime_elapsed_since(start)) );
+  telnet_tx = 0;
+  return ret;
+}
+
+void script_print(void) {
+  int i;
+  script_step *s;
+
+  printf( "Script: %d steps\n", script.nsteps );
+  for( i = 0; i < script.nsteps; i++ ) {
+    s = &script.step[i];
+    printf( "%3d %-14s", i + 1, step_names[s->op] );
+    if( s->op == SCRIPT_ZAP )
+      printf( " r%d c%d %d V, %d samples, max current code %d, energy cutoff %d, width %d us", s->row, s->col,
+	      s->arg[0], s->arg[1], s->max_current_code, s->arg[2], s->arg[3] );
+    else if( s->op == SCRIPT_PROTOCOL_ADD )
+      printf( " %d V, %d samples, energy cutoff %d, interval %d us, width %d us", s->arg[0], s->arg[1], s->arg[2],
+	      s->arg[3], s->arg[4] );
+    else if( s->op == SCRIPT_OPTION )
+      printf( " %s %s", option_names[s->row], s->col ? "on" : "off" );
+    else if( s->op == SCRIPT_DELAY )
+      printf( " %d ms", s->arg[0] );
+    printf( "\n" );
+  }
+}
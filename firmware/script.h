@@ -0,0 +1,52 @@
+#ifndef __SCRIPT_H
+#define __SCRIPT_H
+
+#include <stdint.h>
+
+// plate scripts: a whole plate run, parsed once into a step list and executed on the device, so a run costs one
+// command from the host instead of one round trip per well. The source is the console's own syntax, one command
+// per line, '#' starts a comment:
+//   plate lock | plate unlock
+//   zap <row> <col> <voltage> <depth> <max_current_ma> <energy_cutoff> [width_us]
+//   protocol clear | protocol add <V> <depth> <energy_cutoff> <interval_us> [width_us]
+//   thermal | sequence | hvctl | summary  on/off
+//   delay <ms>
+enum {
+  SCRIPT_LOCK = 0,
+  SCRIPT_UNLOCK,
+  SCRIPT_ZAP,
+  SCRIPT_PROTOCOL_CLEAR,
+  SCRIPT_PROTOCOL_ADD,
+  SCRIPT_OPTION,  // row = which option (SCRIPT_OPT_*), col = on/off
+  SCRIPT_DELAY,   // arg[0] = ms
+};
+
+#define SCRIPT_OPT_THERMAL  0
+#define SCRIPT_OPT_SEQUENCE 1
+#define SCRIPT_OPT_HVCTL    2
+#define SCRIPT_OPT_SUMMARY  3
+
+typedef struct script_step {
+  uint8_t op;
+  uint8_t row;
+  uint8_t col;
+  int16_t max_current_code;  // zap: already converted, as do_zap() takes it
+  uint32_t arg[5];  // zap: voltage, depth, energy_cutoff, width_us; protocol add: a zap_pulse in field order
+} script_step;
+
+#define SCRIPT_MAX_STEPS 128
+#define SCRIPT_FILE_MAX  4096  // largest script tftp_get will take
+
+typedef struct script_t {
+  int nsteps;
+  script_step step[SCRIPT_MAX_STEPS];
+} script_t;
+extern script_t script;
+
+void script_clear(void);
+int script_parse_line(char *line, int lineno);
+int script_fetch(const char *filename);
+int script_run(void);
+void script_print(void);
+
+#endif /* __SCRIPT_H */
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <generated/csr.h>
+
+#include "stats.h"
+#include "systime.h"
+#include "fast.h"
+
+// Latency instrumentation for the zap pipeline. Phases are timed against stats_stamp(), the 64-bit systime
+// counter, so even plate-length phases need no wrap handling.
+
+zap_stats_t zap_stats = {STATS_MAGIC, CONFIG_CLOCK_FREQUENCY};
+
+static uint32_t cur_well;
+
+uint64_t stats_stamp(void) {
+  return systime_now();
+}
+
+__fast static void phase_add(phase_stat *p, uint32_t t) {
+  uint32_t us = t / SYSTIME_TICKS_PER_US;
+  int bucket = 0;
+
+  while( (us >>= 1) && bucket < STATS_HIST_BUCKETS - 1 )
+    bucket++;
+
+  if( p->count == 0 || t < p->min )
+    p->min = t;
+  if( t > p->max )
+    p->max = t;
+  p->sum += t;
+  p->count++;
+  p->hist[bucket]++;
+}
+
+// records the time since start, a stats_stamp() value, against phase
+__fast void stats_record(int phase, uint64_t start) {
+  uint64_t elapsed = systime_elapsed_since(start);
+  uint32_t t = elapsed > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) elapsed;
+
+  phase_add(&zap_stats.plate[phase], t);
+  phase_add(&zap_stats.total[phase], t);
+  if( cur_well < STATS_MAX_WELLS && phase != STATS_PLATE ) {
+    zap_stats.well[cur_well][phase] += t;
+    if( cur_well >= zap_stats.nwells )
+      zap_stats.nwells = cur_well + 1;
+  }
+}
+
+void stats_plate_start(void) {
+  memset(zap_stats.plate, 0, sizeof(zap_stats.plate));
+  memset(zap_stats.well, 0, sizeof(zap_stats.well));
+  zap_stats.nwells = 0;
+  cur_well = 0;
+}
+
+// phases recorded from here on belong to the next well
+void stats_well_next(void) {
+  cur_well++;
+}
+
+void stats_reset(void) {
+  memset(zap_stats.total, 0, sizeof(zap_stats.total));
+  stats_plate_start();
+}
+
+static const char *phase_names[STATS_NUM_PHASES] = {
+  "charge", "retry", "acquire", "upl_log", "upl_nrg", "ui", "safe", "well", "plate",
+};
+
+static void print_phases(const char *scope, phase_stat *p) {
+  int i, b;
+
+  printf( "%s:\n", scope );
+  printf( "  phase    count    min us   mean us    max us\n" );
+  for( i = 0; i < STATS_NUM_PHASES; i++ ) {
+    if( p[i].count == 0 )
+      continue;
+    printf( "  %-8s %5d %9d %9d %9d\n", phase_names[i], p[i].count, p[i].min / SYSTIME_TICKS_PER_US,
+	    (uint32_t) (p[i].sum / p[i].count) / SYSTIME_TICKS_PER_US, p[i].max / SYSTIME_TICKS_PER_US );
+    printf( "           " );
+    for( b = 0; b < STATS_HIST_BUCKETS; b++ ) {
+      if( p[i].hist[b] )
+	printf( " %d@2^%d", p[i].hist[b], b );
+    }
+    printf( "\n" );
+  }
+}
+
+// wells: also list the last plate's per-well breakdown
+void stats_print(int wells) {
+  int w, i;
+
+  print_phases("Last plate", zap_stats.plate);
+  print_phases("Total", zap_stats.total);
+  if( !wells )
+    return;
+
+  printf( "well" );
+  for( i = 0; i < STATS_NUM_PHASES - 1; i++ )
+    printf( " %8s", phase_names[i] );
+  printf( "   (us)\n" );
+  for( w = 0; w < zap_stats.nwells; w++ ) {
+    printf( "%4d", w );
+    for( i = 0; i < STATS_NUM_PHASES - 1; i++ )
+      printf( " %8d", zap_stats.well[w][i] / SYSTIME_TICKS_PER_US );
+    printf( "\n" );
+  }
+}
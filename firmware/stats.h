@@ -0,0 +1,50 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdint.h>
+
+// per-phase latency of the zap pipeline, in sysclk ticks from the systime counter
+enum {
+  STATS_CHARGE = 0,     // wait_until_voltage(), retries included
+  STATS_RETRY,          // one HV supply reset-and-recharge inside wait_until_voltage()
+  STATS_ACQUIRE,        // trigger to frozen capture (the whole sequencer run when sequenced)
+  STATS_UPLOAD_LOG,     // tftp_put of the waveform
+  STATS_UPLOAD_ENERGY,  // tftp_put of the summary and energy files
+  STATS_UI,             // oled_ui()
+  STATS_SAFE,           // wait_until_safe()
+  STATS_WELL,           // one well, end to end
+  STATS_PLATE,          // one do_zap(), end to end
+  STATS_NUM_PHASES
+};
+
+#define STATS_HIST_BUCKETS 20  // bucket i counts phases of 2^i to 2^(i+1) us; the last one takes everything longer
+#define STATS_MAX_WELLS    48
+
+typedef struct phase_stat {
+  uint32_t count;
+  uint32_t min;  // ticks, saturating at 2^32 (about 43s)
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[STATS_HIST_BUCKETS];
+} phase_stat;
+
+// the binary dump is this struct as-is, little endian
+#define STATS_MAGIC 0x5a535431 // "ZST1"
+typedef struct zap_stats_t {
+  uint32_t magic;
+  uint32_t clock_hz;  // ticks per second
+  uint32_t nwells;    // wells recorded in well[] for the last plate
+  phase_stat plate[STATS_NUM_PHASES];  // last do_zap() only
+  phase_stat total[STATS_NUM_PHASES];  // since boot or "stats reset"
+  uint32_t well[STATS_MAX_WELLS][STATS_NUM_PHASES];  // last plate, ticks per phase summed over each well
+} zap_stats_t;
+extern zap_stats_t zap_stats;
+
+uint64_t stats_stamp(void);
+void stats_record(int phase, uint64_t start);
+void stats_plate_start(void);
+void stats_well_next(void);
+void stats_reset(void);
+void stats_print(int wells);
+
+#endif /* __STATS_H */
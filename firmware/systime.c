@@ -0,0 +1,41 @@
+#include <stdint.h>
+
+#include <generated/csr.h>
+
+#include "systime.h"
+#include "fast.h"
+
+// ticks (sysclk cycles) since power-on
+__fast uint64_t systime_now(void) {
+  systime_latch_write(1);
+  return systime_value_read();
+}
+
+__fast uint64_t systime_elapsed_since(uint64_t start) {
+  return systime_now() - start;
+}
+
+uint64_t systime_deadline_us(uint64_t us) {
+  return systime_now() + us * SYSTIME_TICKS_PER_US;
+}
+
+uint64_t systime_deadline_ms(uint64_t ms) {
+  return systime_now() + ms * SYSTIME_TICKS_PER_MS;
+}
+
+__fast int systime_expired(uint64_t deadline) {
+  return systime_now() >= deadline;
+}
+
+// conversions saturate rather than wrap
+uint32_t systime_to_us(uint64_t ticks) {
+  uint64_t us = ticks / SYSTIME_TICKS_PER_US;
+
+  return us > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) us;
+}
+
+uint32_t systime_to_ms(uint64_t ticks) {
+  uint64_t ms = ticks / SYSTIME_TICKS_PER_MS;
+
+  return ms > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t) ms;
+}
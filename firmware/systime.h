@@ -0,0 +1,18 @@
+#ifndef __SYSTIME_H
+#define __SYSTIME_H
+
+#include <stdint.h>
+
+// monotonic time from the gateware's 64-bit sysclk cycle counter; never wraps, so no fixups
+#define SYSTIME_TICKS_PER_US (CONFIG_CLOCK_FREQUENCY / 1000000)
+#define SYSTIME_TICKS_PER_MS (CONFIG_CLOCK_FREQUENCY / 1000)
+
+uint64_t systime_now(void);
+uint64_t systime_elapsed_since(uint64_t start);
+uint64_t systime_deadline_us(uint64_t us);
+uint64_t systime_deadline_ms(uint64_t ms);
+int systime_expired(uint64_t deadline);
+uint32_t systime_to_us(uint64_t ticks);
+uint32_t systime_to_ms(uint64_t ticks);
+
+#endif /* __SYSTIME_H */
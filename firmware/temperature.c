@@ -45,6 +45,17 @@ void max_temperature(int32_t *max, char *zone) {
   }
 }
 
+// returns the most recent reading for a named zone, in 1/10000 C; -1000C if the zone is unknown
+int32_t zone_temperature(const char *zone) {
+  int i;
+
+  for( i = 0; i < NUM_TEMPZONES; i++ ) {
+    if( strncmp(tempzones[i].name, zone, 8) == 0 )
+      return tempzones[i].temperature;
+  }
+  return ZONE_UNKNOWN;
+}
+
 void print_temperature(void) {
   int i;
   uint32_t remainder;
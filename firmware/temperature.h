@@ -1,3 +1,6 @@
 void update_temperature(void);
 void print_temperature(void);
 void max_temperature(int32_t *max, char *zone);
+// zone_temperature() of a zone that isn't in tempzones
+#define ZONE_UNKNOWN (-1000 * 10000)
+int32_t zone_temperature(const char *zone);
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <generated/csr.h>
+
+#include "trace.h"
+#include "systime.h"
+
+// Event ring for post-mortem of plate runs. It lives in .noinit, which crt0 doesn't zero, so after a reboot the
+// previous run's events are still there behind a TRACE_BOOT record. The host side is test/trace.py, fed either the
+// "trace dump" file or the ring read straight out of RAM over Etherbone.
+
+trace_t trace __attribute__((section(".noinit")));
+
+void trace_clear(void) {
+  memset(&trace, 0, sizeof(trace));
+  trace.magic = TRACE_MAGIC;
+  trace.clock_hz = CONFIG_CLOCK_FREQUENCY;
+  trace.nentries = TRACE_ENTRIES;
+}
+
+void trace_init(void) {
+  if( trace.magic != TRACE_MAGIC || trace.nentries != TRACE_ENTRIES || trace.clock_hz != CONFIG_CLOCK_FREQUENCY )
+    trace_clear(); // power-on garbage, or a different build's layout
+  trace_event(TRACE_BOOT, 0, trace.head);
+}
+
+void trace_event(uint16_t event, uint16_t a, uint32_t b) {
+  trace_entry *e = &trace.entry[trace.head & (TRACE_ENTRIES - 1)];
+
+  e->time = systime_now();
+  e->event = event;
+  e->a = a;
+  e->b = b;
+  trace.head++;
+}
+
+static const char *event_names[TRACE_NUM_EVENTS] = {
+  "none", "boot", "zap_start", "zap_end", "charge_start", "charge_retry", "charge_done", "trigger", "pulse_end",
+  "energy_cutoff", "arc", "scram", "tftp_retry", "tftp_fail", "arp_miss", "motor_jam", "i2c_error",
+};
+
+// the last n records, oldest first
+void trace_print(int n) {
+  uint32_t i, start;
+
+  if( n <= 0 || n > TRACE_ENTRIES )
+    n = TRACE_ENTRIES;
+  if( (uint32_t) n > trace.head )
+    n = trace.head;
+  start = trace.head - n;
+
+  printf( "Trace: %d records, ring at 0x%08lx (%d bytes)\n", trace.head, (unsigned long) &trace, (int) sizeof(trace) );
+  for( i = start; i < trace.head; i++ ) {
+    trace_entry *e = &trace.entry[i & (TRACE_ENTRIES - 1)];
+    printf( "%6d %10d.%03d %-14s %5d 0x%08x\n", i, systime_to_ms(e->time) / 1000, systime_to_ms(e->time) % 1000,
+	    e->event < TRACE_NUM_EVENTS ? event_names[e->event] : "?", e->a, (unsigned int) e->b );
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+// post-mortem event ring: timestamped fixed-size records, written with a handful of stores and no formatting
+enum {
+  TRACE_NONE = 0,
+  TRACE_BOOT,          // b = records written before this boot (the ring survives a reboot)
+  TRACE_ZAP_START,     // a = volts, b = wells
+  TRACE_ZAP_END,       // a = 1 if aborted
+  TRACE_CHARGE_START,  // a = target volts
+  TRACE_CHARGE_RETRY,  // a = retry number, b = slow ADC code it stalled at
+  TRACE_CHARGE_DONE,   // a = 0 converged, 1 timeout, 2 overshoot; b = retries
+  TRACE_TRIGGER,       // a = well, b = volts; single-well runs only, the sequencer triggers itself
+  TRACE_PULSE_END,     // a = well | end_cause << 8, b = engaged cycles (sequenced runs: the sequencer's result word)
+  TRACE_ENERGY_CUTOFF, // a = well, b = energy accumulator, low 32 bits
+  TRACE_ARC,           // a = well, b = samples from the trigger to the arc scram
+  TRACE_SCRAM,         // a = where (TRACE_SCRAM_*), b = sequencer index
+  TRACE_TFTP_RETRY,    // a = block (0 for the request), b = tries left
+  TRACE_TFTP_FAIL,     // a = block, b = server IP
+  TRACE_ARP_MISS,      // b = IP that didn't answer
+  TRACE_MOTOR_JAM,     // a = motor current in mA, b = target angle in mrad
+  TRACE_I2C_ERROR,     // a = 7-bit address, b = error count for the transfer
+  TRACE_NUM_EVENTS
+};
+
+#define TRACE_SCRAM_START    0  // zappio already scrammed when the run started
+#define TRACE_SCRAM_SEQUENCE 1  // sequencer fault
+#define TRACE_SCRAM_PROTOCOL 2
+
+#define TRACE_WELL(r, c) ((uint16_t) (((r) << 4) | (c)))
+
+#define TRACE_ENTRIES 512  // power of two
+#define TRACE_MAGIC   0x5a545231 // "ZTR1"
+
+typedef struct trace_entry {
+  uint64_t time;   // systime ticks, which restart from 0 at each TRACE_BOOT
+  uint16_t event;
+  uint16_t a;
+  uint32_t b;
+} trace_entry;
+
+// the binary dump is this struct as-is, little endian. head counts every record ever written, so the oldest one
+// still in the ring is entry[head % nentries] once head passes nentries
+typedef struct trace_t {
+  uint32_t magic;
+  uint32_t clock_hz;
+  uint32_t nentries;
+  uint32_t head;
+  trace_entry entry[TRACE_ENTRIES];
+} trace_t;
+extern trace_t trace;
+
+void trace_init(void);
+void trace_clear(void);
+void trace_event(uint16_t event, uint16_t a, uint32_t b);
+void trace_print(int n);
+
+#endif /* __TRACE_H */
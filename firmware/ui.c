@@ -50,61 +50,6 @@ char ui_notifications[32];
 uint32_t sampledepth = 10000;
 uint8_t status_led = 0;
 
-// convert a desired voltage on the MK HV supply to a code suitable for the HV dac
-uint16_t volts_to_hvdac_code(float voltage) {
-  return (uint16_t) ( (voltage * zappy_cal.fs_dac / 1000.0 ) * zappy_cal.hvdac_m + zappy_cal.hvdac_b);
-}
-
-// convert ADC binary code to voltage for the MKHV vmon supply
-float mk_code_to_voltage(uint16_t code) {
-  float lsb = zappy_cal.p5v_adc_logic / 4096.0;
-  
-  float voltage = ((float)code) * lsb - (zappy_cal.p5v_adc_logic / 8192.0);
-
-  return voltage * 200.0;  // 0-5V ADC corresponds to 0-1000V on supply
-}
-
-// convert the ADC binary code to a voltage
-float convert_code(uint16_t code, uint8_t adc_path) {
-  float lsb = zappy_cal.p5v_adc / 4096.0;
-  
-  float voltage = ((float)code) * lsb - (zappy_cal.p5v_adc / 8192.0);
-  // subtract 0.5LSB as the 0->1 transition occurs at 0.5LSB, not 1.0LSB
-  
-  if( voltage < 0.0 )
-    voltage = 0.0;
-
-  float hv = 0.0;
-  if( adc_path == ADC_SLOW ) {
-    hv = voltage * zappy_cal.slow_m + zappy_cal.slow_b;
-  } else {
-    hv = voltage * zappy_cal.fast_m + zappy_cal.fast_b;
-  }
-
-  if( hv < 0.0 )
-    hv = 0.0;
-
-  return hv;
-}
-
-// convert a voltage into a *measurement* ADC binary code (not for HVDAC purposes)
-// used to program a "SCRAM" target for "do not exceed" feedback levels (if desired)
-// and for capacitor target voltage measurements
-uint16_t convert_voltage_adc_code(float hv, uint8_t adc_path) {
-  float voltage = 0.0;
-  if( adc_path == ADC_SLOW ) {
-    voltage = (hv - zappy_cal.slow_b) / zappy_cal.slow_m;
-  } else {
-    voltage = (hv - zappy_cal.fast_b) / zappy_cal.fast_m;
-  }
-
-  float lsb = zappy_cal.p5v_adc / 4096.0;
-  uint16_t code = (uint16_t) ((voltage + (zappy_cal.p5v_adc / 8192.0)) / lsb); // slightly wrong as it rounds up
-
-  return code;
-}
-
-
 void oled_ui(void) {
   coord_t width, fontheight;
   coord_t height;
@@ -169,7 +114,7 @@ void oled_ui(void) {
                      ui_notifications, font, White, justifyLeft);
   line--;
 
-  snprintf(uiStr, sizeof(uiStr), "%4dV, Row %d Col %d", (int) convert_code(max, ADC_FAST), last_row+1, last_col+1 );
+  snprintf(uiStr, sizeof(uiStr), "%4dV, Row %d Col %d", (int) (adc_code_to_mv(max, ADC_FAST) / 1000), last_row+1, last_col+1 );
   gdispDrawStringBox(0, fontheight * line, width, fontheight * (line + 1),
                      uiStr, font, Gray, justifyLeft);
   line--;
@@ -5,36 +5,18 @@
 #include <generated/csr.h>
 
 #include "uptime.h"
+#include "systime.h"
 
 #include "stdio_wrap.h"
 
-static int uptime_seconds = 0;
-static int last_event;
-
-void uptime_service(void)
-{
-	if(elapsed(&last_event, CONFIG_CLOCK_FREQUENCY)) {
-		uptime_seconds++;
-	}
-}
-
-// return ms since boot
-// doesn't gracefully handle overflow, so perhaps once in 49 days the system will glitch
+// return ms since boot, wrapping cleanly every 49 days (the uGFX tick count is 32 bits)
 uint32_t uptime_ms(void) {
-  int timer_cur;
-  int delta;
-
-  elapsed(&timer_cur, -1);
-  delta = timer_cur - last_event;
-  if( delta < 0 )
-    delta += timer0_reload_read();
-  
-  return uptime_seconds * 1000 + (delta / (CONFIG_CLOCK_FREQUENCY / 1000));
+  return (uint32_t) (systime_now() / SYSTIME_TICKS_PER_MS);
 }
 
 int uptime(void)
 {
-	return uptime_seconds;
+	return (int) (systime_now() / CONFIG_CLOCK_FREQUENCY);
 }
 
 void uptime_print(void)
@@ -45,6 +27,7 @@ void uptime_print(void)
 const char* uptime_str(void)
 {
 	static char buffer[9];
+	int uptime_seconds = uptime();
 	sprintf(buffer, "%02d:%02d:%02d",
 		(uptime_seconds/3600)%24,
 		(uptime_seconds/60)%60,
@@ -1,7 +1,6 @@
 #ifndef __UPTIME_H
 #define __UPTIME_H
 
-void uptime_service(void);
 int uptime(void);
 uint32_t uptime_ms(void);
 
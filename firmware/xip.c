@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "xip.h"
+
+// Rebuilt on every XIP link (see the Makefile), so the stamp identifies the build: a stale or blank flash image
+// fails the check instead of being jumped into.
+
+typedef struct xip_header {
+  uint32_t magic;
+  char stamp[24];
+} xip_header;
+
+static const char build_stamp[] = __DATE__ " " __TIME__;
+
+// first thing in the xip region, ahead of any code
+const xip_header xip_flash_header __attribute__((section(".xip.header"))) = {XIP_MAGIC, __DATE__ " " __TIME__};
+
+// returns 0 if the code in flash belongs to this build
+int xip_check(void) {
+  // read through volatile: the compiler knows what this build put there, the point is what the flash holds
+  const volatile xip_header *h = &xip_flash_header;
+  char stamp[sizeof(h->stamp) + 1];
+  unsigned int i;
+
+  if( h->magic != XIP_MAGIC ) {
+    printf( "XIP: no code in flash (magic %08x) : zerr\n", (unsigned int) h->magic );
+    return 1;
+  }
+  for( i = 0; i < sizeof(h->stamp); i++ )
+    stamp[i] = h->stamp[i];
+  stamp[i] = 0;
+  if( strcmp(stamp, build_stamp) ) {
+    printf( "XIP: flash holds the code of the %s build, this is %s : zerr\n", stamp, build_stamp );
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef __XIP_H
+#define __XIP_H
+
+// execute-in-place: with XIP=yes, linker-xip.ld puts the cold objects' code and constants in the "xip" flash region
+// instead of main_ram. That half of the firmware is programmed separately (firmware-xip.bin), so it's checked against
+// this build before anything calls into it
+#define XIP_MAGIC 0x5a584950 // "ZXIP"
+
+int xip_check(void);
+
+#endif /* __XIP_H */
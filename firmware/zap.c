@@ -15,6 +15,12 @@
 #include "zap.h"
 #include "delay.h"
 #include "ui.h"
+#include "temperature.h"
+#include "zappy-calibration.h"
+#include "stats.h"
+#include "trace.h"
+#include "fast.h"
+#include "systime.h"
 
 #include <net/microudp.h>
 #include <net/tftp.h>
@@ -25,77 +31,269 @@ uint32_t wait_until_voltage(uint32_t voltage);
 uint8_t last_row = 0;
 uint8_t last_col = 0;
 
-#define VOLT_TOLERANCE 0.01
+#define VOLT_TOLERANCE 10    // charge tolerance, per mille of the target voltage
+#define OVER_TOLERANCE 10    // overshoot warning threshold, per mille over the target, at every voltage
 #define WAIT_TIMEOUT   100   // timeout in ms
 #define WAIT_CHARGE_TIMEOUT 250 // timout in ms
-#define SAFE_THRESH    10.0  // safety threshold in volts, if under this, we can move to next operation
+#define SAFE_THRESH    10000 // safety threshold in millivolts, if under this, we can move to next operation
 #define CHARGE_RETRY_LIMIT 3
+#define CHARGE_SETTLE_SAMPLES 8 // consecutive in-band slow samples before the comparator calls the cap charged
+#define MONITOR_EV_CHARGED (1 << 1) // event order in Zappy_adc: acquisition_done, charged
+#define PRETRIGGER_SAMPLES 1000 // samples of history ahead of the trigger in each zap log. IF THIS CHANGES -- need to update zappy.py to change the preamble compensation time
+
+// thermal-aware scheduling: when zap_thermal is set, wells are visited in an interleaved order so
+// consecutive pulses land away from each other on the plate, and a cool-down is inserted only when
+// the predicted temperature of a zone after the next pulse would cross its limit
+uint8_t zap_thermal = 0;
+
+typedef struct thermal_limit {
+  char name[8];
+  int32_t limit;           // in 1/10000 C, same units as tempzones
+  int32_t rise_per_joule;  // predicted rise in 1/10000 C per joule delivered, conservative estimate
+} thermal_limit;
+
+#define NUM_THERMAL_LIMITS 3
+static const thermal_limit thermal_limits[NUM_THERMAL_LIMITS] = {
+  {"dischrg", 700000, 20000},
+  {"hvbleed", 650000,  5000},
+  {"plate",   450000, 10000},
+};
+#define THERMAL_POLL_INTERVAL 250   // ms between temperature re-reads during a cool-down
+#define THERMAL_COOL_TIMEOUT  60000 // ms, give up on cooling after this long
+
+// waits until every zone has headroom for a pulse of next_mj millijoules
+// returns the number of ms spent cooling, or -1 if the zones never cooled down
+static int32_t thermal_cooldown(uint32_t next_mj) {
+  int32_t waited = 0;
+  int32_t predicted, current;
+  int i, hot;
+
+  while( 1 ) {
+    update_temperature();
+    hot = -1;
+    for( i = 0; i < NUM_THERMAL_LIMITS; i++ ) {
+      current = zone_temperature(thermal_limits[i].name);
+      if( current == ZONE_UNKNOWN ) { // a misnamed zone would otherwise always read cold and disable the interlock
+	snprintf(ui_notifications, sizeof(ui_notifications), "Zap: no zone %s", thermal_limits[i].name);
+	printf( "ERROR: thermal limit zone '%s' is not a temperature zone : zerr\n", thermal_limits[i].name );
+	return -1;
+      }
+      predicted = current + (int32_t) ((thermal_limits[i].rise_per_joule * (int64_t) next_mj) / 1000);
+      if( predicted >= thermal_limits[i].limit ) {
+	hot = i;
+	break;
+      }
+    }
+    if( hot < 0 )
+      return waited;
+    
+    if( waited >= THERMAL_COOL_TIMEOUT ) {
+      snprintf(ui_notifications, sizeof(ui_notifications), "Zap: %s too hot", thermal_limits[hot].name);
+      printf( "ERROR: zone '%s' did not cool down in %d ms : zerr\n", thermal_limits[hot].name, waited );
+      return -1;
+    }
+    if( waited == 0 ) {
+      snprintf(ui_notifications, sizeof(ui_notifications), "Zap: cooling %s", thermal_limits[hot].name);
+      oled_ui();
+    }
+    delay(THERMAL_POLL_INTERVAL);
+    waited += THERMAL_POLL_INTERVAL;
+  }
+}
+
+// fill order[] with start..end-1, evens first then odds, so neighbouring indices are not visited back to back
+static int interleave(uint8_t *order, int start, int end) {
+  int i, n = 0;
+
+  for( i = start; i < end; i++ ) {
+    if( (i & 1) == 0 )
+      order[n++] = i;
+  }
+  for( i = start; i < end; i++ ) {
+    if( (i & 1) == 1 )
+      order[n++] = i;
+  }
+  return n;
+}
+
+// sequenced runs: the whole visiting order goes into the ZapSequencer table and runs in gateware back to back,
+// with each well captured into its own region of monitor memory. firmware only charges the first well and uploads
+uint8_t zap_sequenced = 0;
+
+// closed-loop charging: when zap_hvctl is set, the gateware ChargeController drives the HV DAC from the slow ADC
+// instead of firmware writing one fixed hv_setting, boosting first and then trimming to the target
+uint8_t zap_hvctl = 0;
+#define HVCTL_BOOST 1200  // boost phase setpoint, per mille of the target voltage
+
+// summary-only uploads: every well gets a 64-byte zappy-summary file built from the monitor's pulse metrics; when
+// zap_summary_only is set, that replaces the full zappy-log waveform and zappy-energy uploads
+uint8_t zap_summary_only = 0;
+
+zap_protocol_t zap_protocol; // npulses 0: one pulse per well
+
+#define SUMMARY_NONE 0xFFFF // crossing never happened
+typedef struct pulse_summary { // 16 words, little-endian. Voltages are raw ADC codes, times are samples of period
+  uint32_t well;      // [7:0] row, [15:8] col, both 1-based; [31:16] charge voltage setpoint, V
+  uint32_t period;    // sample period, in us (the monitor's decimation of its 1 MSPS stream)
+  uint32_t samples;   // samples from the trigger to the end of the capture
+  uint32_t v0;        // slow code at the trigger
+  uint32_t vend;      // slow code at the end
+  uint32_t vpeak;     // max fast code
+  uint32_t vmin;      // min fast code after the rise
+  uint32_t ipeak;     // max slow - fast code, i.e. current * capres
+  uint32_t charge;    // sum of slow - fast codes
+  uint32_t rise10;    // crossings of 10%/90% of v0 on fast, SUMMARY_NONE if missed
+  uint32_t rise90;
+  uint32_t fall90;
+  uint32_t fall10;
+  uint32_t falltau;   // falltau - fall90 is the decay time constant
+  uint32_t energy_lo; // energy accumulator, as in zappy-energy
+  uint32_t energy_hi;
+} pulse_summary;
+
+__fast static void read_pulse_summary(pulse_summary *s, uint8_t row, uint8_t col, uint32_t voltage) {
+  uint64_t energy = monitor_energy_accumulator_read();
+
+  s->well = (row + 1) | ((col + 1) << 8) | (voltage << 16);
+  s->period = monitor_period_read();
+  s->samples = monitor_metrics_samples_read();
+  s->v0 = monitor_metrics_v0_read();
+  s->vend = monitor_metrics_vend_read();
+  s->vpeak = monitor_metrics_vpeak_read();
+  s->vmin = monitor_metrics_vmin_read();
+  s->ipeak = monitor_metrics_ipeak_read();
+  s->charge = monitor_metrics_charge_read();
+  s->rise10 = monitor_metrics_rise10_read();
+  s->rise90 = monitor_metrics_rise90_read();
+  s->fall90 = monitor_metrics_fall90_read();
+  s->fall10 = monitor_metrics_fall10_read();
+  s->falltau = monitor_metrics_falltau_read();
+  s->energy_lo = (uint32_t) energy;
+  s->energy_hi = (uint32_t) (energy >> 32);
+}
+
+#define SEQ_WORDS_PER_ENTRY 8
+#define SEQ_MAX_ENTRIES     (SEQUENCER_SIZE / (SEQ_WORDS_PER_ENTRY * 4))
+#define SEQ_PRETRIGGER      100  // samples; the pre-roll is dead time between wells, so keep it short
+#define SEQ_DONE            0x80000000
+#define SEQ_ARC             0x100
+#define SEQ_TIME            0x400
+#define SEQ_ARC_SAMPLE(w)   (((w) >> 11) & 0xFFFF) // samples from the trigger to the arc scram
+#define SEQ_WIDTH_MAX       0x7FFFFF // word 3 has 23 bits of pulse width, about 83ms at 100MHz
+
+// hardware pulse width in sysclk cycles, clamped to what a sequencer entry can hold so every path times the same
+static uint32_t width_cycles(uint32_t width_us) {
+  uint32_t max_us = SEQ_WIDTH_MAX / (CONFIG_CLOCK_FREQUENCY / 1000000);
+
+  if( width_us > max_us ) {
+    printf( "Pulse width %d us clamped to %d us : zwarn\n", width_us, max_us );
+    width_us = max_us;
+  }
+  return width_us * (CONFIG_CLOCK_FREQUENCY / 1000000);
+}
+
+// latest slow ADC code. The monitor's ADCs free-run, so this is live whether or not a capture is going
+static uint16_t slow_adc_code(void) {
+  return monitor_cur_adc_read();
+}
+
+// charge tolerance for a voltage, per mille
+static uint32_t charge_tolerance(uint32_t voltage) {
+  // at lower voltages, the tolerance is not as tight due to the range becoming smaller relative to the absolute accuracy of the circuitry
+  if( voltage < 120 )
+    return 50;
+  if( voltage < 200 )
+    return 25;
+  return VOLT_TOLERANCE;
+}
+
+// programs the gateware charge comparator for voltage (+/- tolerance) and turns it on. The comparator runs on every slow
+// sample, captured or not, so charged rises on the first in-band pass. Overshoot is flagged at OVER_TOLERANCE, inside
+// the wider low-voltage bands, so the warning trips at the same 1% it always has
+static void charge_comparator_setup(uint32_t voltage, uint32_t volt_tolerance) {
+  uint16_t target = mv_to_adc_code(voltage * 1000, ADC_SLOW);
+  uint16_t low = mv_to_adc_code(voltage * (1000 - volt_tolerance), ADC_SLOW);
+  uint16_t high = mv_to_adc_code(voltage * (1000 + OVER_TOLERANCE), ADC_SLOW);
+
+  monitor_charge_target_write(target);
+  monitor_charge_band_write(target > low ? target - low : 1);
+  monitor_charge_over_band_write(high > target ? high - target : 1);
+  monitor_charge_settle_write(CHARGE_SETTLE_SAMPLES);
+  // keep the autotrigger bit: do_zap() owns it
+  monitor_charge_ctl_write(monitor_charge_ctl_read() | (1 << CSR_MONITOR_CHARGE_CTL_ENABLE_OFFSET));
+  monitor_ev_pending_write(MONITOR_EV_CHARGED); // charged is sticky in the event pending bit, so a pulse can't be missed
+}
+
+// hands the HV DAC to the charge controller; the comparator target doubles as the controller's target
+static void hvctl_start(uint32_t voltage) {
+  uint32_t boost = voltage * HVCTL_BOOST; // in mV
+
+  if( boost > 1000000 )
+    boost = 1000000;
+  charge_comparator_setup(voltage, charge_tolerance(voltage)); // same band wait_until_voltage() uses
+  hvctl_feedforward_write(mv_to_hvdac_code(voltage * 1000));
+  hvctl_boost_write(mv_to_hvdac_code(boost));
+  hvctl_code_max_write(mv_to_hvdac_code(1000000));
+  hvctl_ctl_write(1); // also clears any fault and restarts from the boost phase
+}
 
 // returns 0 if success, 1 if timeout
-uint32_t wait_until_voltage(uint32_t voltage) {
+__fast uint32_t wait_until_voltage(uint32_t voltage) {
   // core acquisition/trigger loop
-  int acq_timer, start_time, delta;
-  float pct_diff;
-  float cur_v = 0.0;
-  uint16_t  *data = (uint16_t *)MONITOR_BASE;
+  uint64_t deadline;
   int charge_retry = 0;
   int converged = 0;
-  float volt_tolerance = VOLT_TOLERANCE;
-
-  // at lower voltages, the tolerance is not as tight due to the range becoming smaller relative to the absolute accuracy of the circuitry
-  if( voltage < 200 )
-    volt_tolerance = 0.025;
-  if( voltage < 120 )
-    volt_tolerance = 0.05;
+  uint32_t volt_tolerance = charge_tolerance(voltage);
+  uint64_t charge_start = stats_stamp();
 
   // setup the loop to run
-  zappio_triggerclear_write(1);
-  monitor_depth_write(10);
-  monitor_presample_write(10); // presample == depth will prevent trigger from ever happening
+  // with autotrigger armed, the trigger may already be latched by the time we get here, so leave it alone
+  if( !(monitor_charge_ctl_read() & (1 << CSR_MONITOR_CHARGE_CTL_AUTOTRIGGER_OFFSET)) )
+    zappio_triggerclear_write(1);
+  charge_comparator_setup(voltage, volt_tolerance);
+  trace_event(TRACE_CHARGE_START, voltage, 0);
 
-  elapsed(&acq_timer, -1);
-  start_time = acq_timer;
+  deadline = systime_deadline_ms(WAIT_CHARGE_TIMEOUT);
   while( charge_retry < CHARGE_RETRY_LIMIT && !converged ) {
-    do {
-      pct_diff = ((float) voltage) - cur_v;
-      pct_diff = pct_diff / (float) voltage;
-      
-      monitor_acquire_write(1); // start acquisition & trigger cycle
-      while( monitor_done_read() ) // wait for done to go 0
-	;
-      while( monitor_done_read() == 0 ) // wait for done to go back to a 1
-	; // in this loop here, we could monitor the current and stop the zap if it goes too high
-      
-    
-      // update delta timer
-      elapsed(&acq_timer, -1);
-      delta = acq_timer - start_time;
-      if( delta < 0 )
-	delta += timer0_reload_read();
-      
-      // grab the voltage
-      cur_v = convert_code(data[0], ADC_SLOW); // index 0 is slow, index 1 is fast
-      //    printf( "debug: cur_v = %dmV, delta %dms, pct_diff %d\n", (int) (cur_v * 1000), ((delta)*1000/CONFIG_CLOCK_FREQUENCY), (int) (pct_diff * 100));
-    } while( (pct_diff >= volt_tolerance) && (((delta)*1000/CONFIG_CLOCK_FREQUENCY) < WAIT_CHARGE_TIMEOUT) );
+    while( !(monitor_ev_pending_read() & MONITOR_EV_CHARGED) && !monitor_charge_over_read() &&
+	   !(zap_hvctl && hvctl_fault_read()) && // the controller spots a stalled supply long before the timeout
+	   !systime_expired(deadline) )
+      ;
   
-    if( pct_diff < -0.01 ) {
+    if( monitor_charge_over_read() ) { // may also be in band (and charged) when the band is wider than 1%
       snprintf(ui_notifications, sizeof(ui_notifications), "Zap: HV overshoot");
       printf( "warning: target voltage overshoot! : zwarn\n" );
       // return immediately in this case, to avoid any further charging of the capacitor
+      stats_record(STATS_CHARGE, charge_start);
+      trace_event(TRACE_CHARGE_DONE, 2, charge_retry);
       return 0;
     }
     
-    if( pct_diff >= volt_tolerance ) {
+    if( !(monitor_ev_pending_read() & MONITOR_EV_CHARGED) ) {
       // the charging didn't converge, could be due to OC condition on the HV supply.
       // re-set the supply by turning it off, then turning it back on again
       converged = 0;
+      uint64_t retry_start = stats_stamp();
+      trace_event(TRACE_CHARGE_RETRY, charge_retry + 1, monitor_cur_adc_read());
       
+      // disarm the autotrigger and drop the well selection for the whole recovery: the cap swings through the
+      // charge band on the way down and back up, and must not fire into a well on the way
+      uint32_t autotrigger = monitor_charge_ctl_read() & (1 << CSR_MONITOR_CHARGE_CTL_AUTOTRIGGER_OFFSET);
+      uint32_t row = zappio_row_read();
+      uint32_t col = zappio_col_read();
+      monitor_charge_ctl_write(monitor_charge_ctl_read() & ~(1 << CSR_MONITOR_CHARGE_CTL_AUTOTRIGGER_OFFSET));
+      zappio_row_write(0);
+      zappio_col_write(0);
       zappio_triggerclear_write(1); // make sure we're not in a triggered state that would engage row/col
       
       snprintf(ui_notifications, sizeof(ui_notifications), "Zap: HV converge retry");
       printf( "warning: HV supply convergence retry, should be benign : zwarn\n" );
       
       /////////// disengage the HV supply and re-engage it to clear any transient OC condition ////////
+      if( zap_hvctl )
+	printf( "HV supply stalled at %d mV (charge controller fault %d) : zinfo\n",
+		(int) adc_code_to_mv(monitor_cur_adc_read(), ADC_SLOW), hvctl_fault_read() );
+      hvctl_ctl_write(0); // DAC falls back to hv_setting
       zappio_hv_setting_write(0);  // set supply to zero
       while( !zappio_hv_ready_read() )
 	;
@@ -114,19 +312,24 @@ uint32_t wait_until_voltage(uint32_t voltage) {
       //////////// update & re-engage the MKHV supply //////////////
       zappio_hv_engage_write(1);  // engage the supply before writing, under the theory that the supply is at 0
   
-      zappio_hv_setting_write(volts_to_hvdac_code((float)voltage));
-      while( !zappio_hv_ready_read() )
-	;
-      zappio_hv_update_write(1); // commit the voltage
+      if( zap_hvctl ) {
+	hvctl_start(voltage);
+      } else {
+	zappio_hv_setting_write(mv_to_hvdac_code(voltage * 1000));
+	while( !zappio_hv_ready_read() )
+	  ;
+	zappio_hv_update_write(1); // commit the voltage
+      }
 
-      // re-initialize all the loop parameters
-      cur_v = 0.0;
+      // re-initialize all the loop parameters; the supply is back and charged is clear, so it's safe to re-arm
       zappio_triggerclear_write(1);
-      monitor_depth_write(10);
-      monitor_presample_write(10); // presample == depth will prevent trigger from ever happening
+      monitor_ev_pending_write(MONITOR_EV_CHARGED);
+      zappio_row_write(row);
+      zappio_col_write(col);
+      monitor_charge_ctl_write(monitor_charge_ctl_read() | autotrigger);
+      stats_record(STATS_RETRY, retry_start);
       
-      elapsed(&acq_timer, -1);
-      start_time = acq_timer;
+      deadline = systime_deadline_ms(WAIT_CHARGE_TIMEOUT);
     } else {
       converged = 1;
     }
@@ -134,7 +337,9 @@ uint32_t wait_until_voltage(uint32_t voltage) {
     charge_retry++;
   }
     
-  delay_ms(1);  // wait 1 millisecond longer, this should help improve any convergence/noise gap
+  // no settling delay needed: charged only rises after CHARGE_SETTLE_SAMPLES consecutive in-band samples
+  stats_record(STATS_CHARGE, charge_start);
+  trace_event(TRACE_CHARGE_DONE, !converged, converged ? charge_retry - 1 : charge_retry);
 
   if( !converged )
     return 1; // timed out
@@ -142,48 +347,58 @@ uint32_t wait_until_voltage(uint32_t voltage) {
     return 0;
 }
 
+// times n passes of wait_until_voltage()'s inner poll (the charged/overshoot/fault CSR reads and the deadline
+// check), each long enough to round-trip systime; min and max are in sysclk ticks. The spread is the jitter on how
+// soon the loop sees the charged flag, so it's the number to compare between USE_FAST builds
+__fast void zap_poll_bench(int n, uint32_t *min, uint32_t *max) {
+  uint64_t deadline = systime_deadline_ms(WAIT_CHARGE_TIMEOUT);
+  uint64_t start;
+  uint32_t t;
+  volatile int hits = 0;
+
+  *min = 0xFFFFFFFF;
+  *max = 0;
+  for( int i = 0; i < n; i++ ) {
+    start = systime_now();
+    if( (monitor_ev_pending_read() & MONITOR_EV_CHARGED) || monitor_charge_over_read() ||
+	(zap_hvctl && hvctl_fault_read()) || systime_expired(deadline) )
+      hits++;
+    t = (uint32_t) systime_elapsed_since(start);
+    if( t < *min )
+      *min = t;
+    if( t > *max )
+      *max = t;
+  }
+}
+
 // returns 0 if success
-uint32_t wait_until_safe(void) {
-  int acq_timer, start_time, delta;
-  float cur_v = 0.0;
-  float mk_v = 0.0;
-  uint16_t  *data = (uint16_t *)MONITOR_BASE;
+__fast uint32_t wait_until_safe(void) {
+  uint64_t deadline;
+  uint32_t cur_mv = 0;
+  int32_t mk_mv = 0;
+  uint64_t safe_start = stats_stamp();
   
   zappio_triggerclear_write(1);
-  monitor_depth_write(10);
-  monitor_presample_write(10); // presample == depth will prevent trigger from ever happening
 
-  elapsed(&acq_timer, -1);
-  start_time = acq_timer;
+  deadline = systime_deadline_ms(WAIT_TIMEOUT);
   do {
-    monitor_acquire_write(1); // start acquisition & trigger cycle
-    while( monitor_done_read() ) // wait for done to go 0
-      ;
-    while( monitor_done_read() == 0 ) // wait for done to go back to a 1
-      ; // in this loop here, we could monitor the current and stop the zap if it goes too high
-
     vmon_acquire_write(1);
     while( !vmon_valid_read() )
       ;
-    mk_v = mk_code_to_voltage(vmon_data_read());
-      
-    // update delta timer
-    elapsed(&acq_timer, -1);
-    delta = acq_timer - start_time;
-    if( delta < 0 )
-      delta += timer0_reload_read();
+    mk_mv = mk_code_to_mv(vmon_data_read());
 
     // grab the voltage
-    cur_v = convert_code(data[0], ADC_SLOW); // index 0 is slow, index 1 is fast
-  } while( ((cur_v > SAFE_THRESH) || (mk_v > SAFE_THRESH)) && (((delta)*1000/CONFIG_CLOCK_FREQUENCY) < WAIT_TIMEOUT) );
+    cur_mv = adc_code_to_mv(slow_adc_code(), ADC_SLOW);
+  } while( ((cur_mv > SAFE_THRESH) || (mk_mv > SAFE_THRESH)) && !systime_expired(deadline) );
+  stats_record(STATS_SAFE, safe_start);
   
-  if( cur_v > SAFE_THRESH ) {
-    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: main cap unsafe %dV", (int) cur_v);
+  if( cur_mv > SAFE_THRESH ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: main cap unsafe %dV", (int) (cur_mv / 1000));
     status_led = LED_STATUS_RED;
     return 1;
   }
-  if( mk_v > SAFE_THRESH ) {
-    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: MK cap unsafe %dV", (int) mk_v);
+  if( mk_mv > SAFE_THRESH ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: MK cap unsafe %dV", (int) (mk_mv / 1000));
     status_led = LED_STATUS_RED;
     return 2;
   }
@@ -191,12 +406,265 @@ uint32_t wait_until_safe(void) {
   return 0;
 }
 
+// runs every well of the visiting order through the sequencer, then uploads each well's region
+// returns 0 if the run completed, 1 if it was cut short
+static int zap_sequence(uint8_t *row_order, int nrows, uint8_t *col_order, int ncols, uint32_t voltage,
+			uint32_t depth, int16_t max_current_code, uint32_t energy_cutoff, uint32_t width_us) {
+  volatile uint32_t *table = (volatile uint32_t *)SEQUENCER_BASE;
+  uint16_t maxdelta = 0;
+  int ri, ci, n, i, waited, limit_ms;
+  uint64_t charge_start, acq_start, phase_start;
+  
+  n = nrows * ncols;
+  if( n > SEQ_MAX_ENTRIES || n * depth > MONITOR_SIZE / 4 ) {
+    printf( "Sequence of %d wells x %d samples doesn't fit in monitor memory : zerr\n", n, depth );
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: sequence too long");
+    return 1;
+  }
+  if( max_current_code >= 0 && max_current_code <= 0xFFF )
+    maxdelta = (uint16_t) max_current_code;
+
+  i = 0;
+  for( ri = 0; ri < nrows; ri++ ) {
+    for( ci = 0; ci < ncols; ci++ ) {
+      volatile uint32_t *entry = &table[i * SEQ_WORDS_PER_ENTRY];
+      entry[0] = (1 << row_order[ri]) | ((1 << col_order[ci]) << 4) | (depth << 16);
+      entry[1] = (i * depth) | ((uint32_t) maxdelta << 16);
+      entry[2] = energy_cutoff;
+      entry[3] = (energy_cutoff ? (1 << 8) : 0) | (width_cycles(width_us) << 9); // energy_cutoff is only 32 bits wide from the command line
+      entry[5] = 0;
+      entry[6] = 0; // comparator and DAC stay where wait_until_voltage() put them
+      entry[7] = 0;
+      i++;
+    }
+  }
+
+  // charge for the first well by hand; this also leaves the charge comparator running, and the sequencer waits on
+  // it before every well. the measured charge time only sizes the run timeout
+  charge_start = systime_now();
+  if( wait_until_voltage(voltage) ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: charge timeout");
+    status_led = LED_STATUS_RED;
+    printf( "WARNING: timeout waiting for voltage : zwarn" );
+  }
+  uint32_t charge_ms = systime_to_ms(systime_elapsed_since(charge_start));
+  
+  zappio_triggerclear_write(1);
+  monitor_circular_write(0);
+  monitor_presample_write(depth > 2 * SEQ_PRETRIGGER ? SEQ_PRETRIGGER : depth / 2);
+  sequencer_count_write(n);
+  sequencer_holdoff_write(0); // recharge time is set by the comparator, not a fixed holdoff
+  sequencer_stop_on_arc_write(0);
+  acq_start = stats_stamp();
+  sequencer_go_write(1);
+  printf( "Sequencing %d wells : zinfo\n", n );
+
+  limit_ms = n * (2 * charge_ms + depth / 1000 + 2) + WAIT_TIMEOUT;
+  waited = 0;
+  while( sequencer_busy_read() ) {
+    if( waited++ > limit_ms ) {
+      printf( "Sequencer timeout at entry %d : zerr\n", sequencer_index_read() );
+      sequencer_abort_write(1);
+      while( sequencer_busy_read() )
+	;
+      break;
+    }
+    delay_ms(1);
+  }
+  stats_record(STATS_ACQUIRE, acq_start);
+  if( sequencer_fault_read() ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: SCRAM during sequence");
+    printf( "ERROR: scram during sequence after %d wells : zerr\n", sequencer_index_read() );
+    trace_event(TRACE_SCRAM, TRACE_SCRAM_SEQUENCE, sequencer_index_read());
+  }
+
+  // upload whatever ran, same file names as the one-well-at-a-time loop
+  unsigned int ip;
+  char fname[32];
+  char energy[32];
+  ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+  for( i = 0; i < n; i++ ) {
+    volatile uint32_t *entry = &table[i * SEQ_WORDS_PER_ENTRY];
+    int r = row_order[i / ncols];
+    int c = col_order[i % ncols];
+    
+    if( !(entry[5] & SEQ_DONE) )
+      break;
+    trace_event(TRACE_PULSE_END, TRACE_WELL(r, c), entry[5]);
+    if( entry[5] & SEQ_ARC ) {
+      trace_event(TRACE_ARC, TRACE_WELL(r, c), SEQ_ARC_SAMPLE(entry[5]));
+      snprintf(ui_notifications, sizeof(ui_notifications), "Zap: arc on r%d c%d", r+1, c+1);
+      status_led = LED_STATUS_RED;
+      printf( "WARNING: arc on row %d col %d at sample %d : zwarn", r+1, c+1,
+	      (int) SEQ_ARC_SAMPLE(entry[5]) + (depth > 2 * SEQ_PRETRIGGER ? SEQ_PRETRIGGER : depth / 2) );
+    } else if( entry[5] & SEQ_TIME ) {
+      printf( "Pulse width reached on row %d col %d : zinfo\n", r+1, c+1 );
+    }
+    phase_start = stats_stamp();
+    snprintf(fname, sizeof(fname), "zappy-log.r%dc%d", r+1, c+1);
+    tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)((uint32_t *)MONITOR_BASE + i * depth), depth*4);
+    stats_record(STATS_UPLOAD_LOG, phase_start);
+    phase_start = stats_stamp();
+    snprintf(fname, sizeof(fname), "zappy-energy.r%dc%d", r+1, c+1);
+    snprintf(energy, sizeof(energy), "%02x%08x\n", (unsigned int) (entry[5] & 0xFF), (unsigned int) entry[4]);
+    tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)energy, strlen(energy));
+    stats_record(STATS_UPLOAD_ENERGY, phase_start);
+    stats_well_next(); // the run itself lands on the first well; wells only split the uploads here
+    last_row = r;
+    last_col = c;
+  }
+  phase_start = stats_stamp();
+  oled_ui();
+  stats_record(STATS_UI, phase_start);
+  
+  return i != n;
+}
+
+// runs zap_protocol's pulses on one well through the sequencer, recorded back to back from the start of monitor
+// memory, then uploads the recording and one energy line per pulse. do_zap() has already set the first pulse's voltage
+// returns 0 if every pulse ran, 1 if the protocol was cut short
+static int zap_protocol_well(uint8_t r, uint8_t c, int16_t max_current_code) {
+  volatile uint32_t *table = (volatile uint32_t *)SEQUENCER_BASE;
+  uint16_t maxdelta = 0;
+  uint32_t base = 0, pretrigger = PRETRIGGER_SAMPLES;
+  int i, n, waited, limit_ms;
+  uint64_t well_start = stats_stamp(), phase_start;
+
+  n = zap_protocol.npulses;
+  if( max_current_code >= 0 && max_current_code <= 0xFFF )
+    maxdelta = (uint16_t) max_current_code;
+
+  limit_ms = WAIT_TIMEOUT;
+  for( i = 0; i < n; i++ ) {
+    zap_pulse *p = &zap_protocol.pulse[i];
+    volatile uint32_t *entry = &table[i * SEQ_WORDS_PER_ENTRY];
+    uint16_t target = mv_to_adc_code(p->voltage * 1000, ADC_SLOW);
+    uint16_t low = mv_to_adc_code(p->voltage * (1000 - charge_tolerance(p->voltage)), ADC_SLOW);
+    uint32_t holdoff = (p->interval_us * (CONFIG_CLOCK_FREQUENCY / 1000000) + 4095) / 4096;
+
+    if( holdoff > 0xFFFF )
+      holdoff = 0xFFFF;
+    entry[0] = (1 << r) | ((1 << c) << 4) | (p->depth << 16);
+    entry[1] = base | ((uint32_t) maxdelta << 16);
+    entry[2] = p->energy_cutoff;
+    entry[3] = (p->energy_cutoff ? (1 << 8) : 0) | (width_cycles(p->width_us) << 9);
+    entry[5] = 0;
+    entry[6] = target | ((uint32_t) (target > low ? target - low : 1) << 12);
+    entry[7] = mv_to_hvdac_code(p->voltage * 1000) | (holdoff << 16); // the charge controller takes it as feedforward
+    base += p->depth;
+    if( p->depth / 2 < pretrigger )
+      pretrigger = p->depth / 2;
+    limit_ms += p->interval_us / 1000 + p->depth / 1000 + WAIT_CHARGE_TIMEOUT;
+  }
+
+  if( wait_until_voltage(zap_protocol.pulse[0].voltage) ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: charge timeout");
+    status_led = LED_STATUS_RED;
+    printf( "WARNING: timeout waiting for voltage : zwarn" );
+  }
+
+  zappio_triggerclear_write(1);
+  monitor_circular_write(0);
+  monitor_presample_write(pretrigger);
+  sequencer_count_write(n);
+  sequencer_holdoff_write(0); // entries with no interval fire as soon as the cap is back in band
+  sequencer_stop_on_arc_write(1); // the rest of the protocol is pointless on a well that arced
+  phase_start = stats_stamp();
+  sequencer_go_write(1);
+  printf( "Protocol of %d pulses on r%d c%d : zinfo\n", n, r+1, c+1 );
+
+  waited = 0;
+  while( sequencer_busy_read() ) {
+    if( waited++ > limit_ms ) {
+      printf( "Protocol timeout at pulse %d : zerr\n", sequencer_index_read() );
+      sequencer_abort_write(1);
+      while( sequencer_busy_read() )
+	;
+      break;
+    }
+    delay_ms(1);
+  }
+  stats_record(STATS_ACQUIRE, phase_start);
+  if( sequencer_fault_read() ) {
+    snprintf(ui_notifications, sizeof(ui_notifications), "Zap: SCRAM during protocol");
+    printf( "ERROR: scram during protocol after %d pulses : zerr\n", sequencer_index_read() );
+    trace_event(TRACE_SCRAM, TRACE_SCRAM_PROTOCOL, sequencer_index_read());
+  }
+
+  // upload the pulses that ran as one recording, plus their energies
+  unsigned int ip;
+  char fname[32];
+  char energy[PROTOCOL_MAX_PULSES * 11 + 1];
+  int len = 0;
+  ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
+  base = 0;
+  for( i = 0; i < n; i++ ) {
+    volatile uint32_t *entry = &table[i * SEQ_WORDS_PER_ENTRY];
+
+    if( !(entry[5] & SEQ_DONE) )
+      break;
+    trace_event(TRACE_PULSE_END, TRACE_WELL(r, c), entry[5]);
+    if( entry[5] & SEQ_ARC ) {
+      trace_event(TRACE_ARC, TRACE_WELL(r, c), SEQ_ARC_SAMPLE(entry[5]));
+      snprintf(ui_notifications, sizeof(ui_notifications), "Zap: arc on r%d c%d", r+1, c+1);
+      status_led = LED_STATUS_RED;
+      printf( "WARNING: arc on row %d col %d pulse %d, %d samples after its trigger : zwarn", r+1, c+1, i+1,
+	      (int) SEQ_ARC_SAMPLE(entry[5]) );
+    }
+    base += zap_protocol.pulse[i].depth;
+    len += snprintf(energy + len, sizeof(energy) - len, "%02x%08x\n", (unsigned int) (entry[5] & 0xFF), (unsigned int) entry[4]);
+  }
+  phase_start = stats_stamp();
+  snprintf(fname, sizeof(fname), "zappy-log.r%dc%d", r+1, c+1);
+  tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)MONITOR_BASE, base*4);
+  stats_record(STATS_UPLOAD_LOG, phase_start);
+  phase_start = stats_stamp();
+  snprintf(fname, sizeof(fname), "zappy-energy.r%dc%d", r+1, c+1);
+  tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)energy, len);
+  stats_record(STATS_UPLOAD_ENERGY, phase_start);
+  last_row = r;
+  last_col = c;
+  phase_start = stats_stamp();
+  oled_ui();
+  stats_record(STATS_UI, phase_start);
+  stats_record(STATS_WELL, well_start);
+  stats_well_next();
+
+  return i != n;
+}
+
+int16_t zap_max_current_code(int32_t max_current_ma) {
+  int16_t max_current_code;
+
+  if( max_current_ma < 0 )
+    return -1; // tells the loop to ignore the setting
+  // turn current into a voltage by multiplying it by capres
+  uint32_t max_mv = ma_to_mv((uint32_t) max_current_ma);
+  if( max_mv > 1000000 )
+    max_mv = 1000000;
+  // we assume ADC_SLOW is the "master" calibration path for the reference curves
+  max_current_code = (int16_t) mv_to_adc_code(max_mv, ADC_SLOW);
+  if( max_current_code > 0xfff )
+    max_current_code = 0xfff;
+  return max_current_code;
+}
+
 // depth is equivalent to time in microseconds (each sample is one microsecond)
-int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16_t max_current_code, uint32_t energy_cutoff) {
+int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16_t max_current_code, uint32_t energy_cutoff,
+	       uint32_t width_us) {
   int r, c, rstart, cstart, rend, cend;
+  uint32_t pretrigger;
   
   telnet_tx = 1;
   snprintf(ui_notifications, sizeof(ui_notifications), "Zap: completed"); // set a defalut "all good" message
+
+  if( zap_protocol.npulses > 0 ) {
+    // the first pulse is charged like a single zap, and the whole recording has to fit like a single capture
+    voltage = zap_protocol.pulse[0].voltage;
+    depth = 0;
+    for( r = 0; r < zap_protocol.npulses; r++ )
+      depth += zap_protocol.pulse[r].depth;
+  }
   
   if( voltage > 1000 ) {
     printf( "Voltage out of range (0-1000): %d : zerr\n", voltage );
@@ -232,7 +700,7 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
     cstart = col;
     cend = col + 1;
   }
-  if( depth >= 16384 ) { // this constant is in zappy.py memdepth
+  if( depth >= ZAP_MAX_DEPTH ) {
     printf( "Depth too long: %d : zerr\n", depth );
     snprintf(ui_notifications, sizeof(ui_notifications), "Zap: depth err %d", depth);
     status_led = LED_STATUS_RED;
@@ -240,12 +708,15 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
   } else {
     sampledepth = depth; // global for the UI routine
   }
+  // the monitor needs at least one post-trigger sample; short runs split the buffer evenly
+  pretrigger = depth > 2 * PRETRIGGER_SAMPLES ? PRETRIGGER_SAMPLES : depth / 2;
 
   // basic safety status
   if( zappio_scram_status_read() ) {
     printf( "ERROR: zappio is indicating a SCRAM condition. Aborting. : zerr\n" );
     snprintf(ui_notifications, sizeof(ui_notifications), "Zap: SCRAM abort");
     status_led = LED_STATUS_RED;
+    trace_event(TRACE_SCRAM, TRACE_SCRAM_START, 0);
     return -1;
   }
   if( zappio_override_safety_read() ) {
@@ -275,6 +746,14 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
   } else {
     zappio_maxdelta_ena_write(0);
   }
+  // hardware pulse-width timer for the single-well loop; sequenced runs carry it per entry
+  zappio_pulse_width_write(width_cycles(width_us));
+
+  // per-phase latency of this plate, for the stats command
+  stats_plate_start();
+  uint64_t plate_start = stats_stamp();
+  trace_event(TRACE_ZAP_START, voltage, (rend - rstart) * (cend - cstart));
+  uint64_t well_start, phase_start;
 
   // disconnect fast-discharge resistor, connect capacitor
   zappio_discharge_write(0); // make sure the discharge resistor is disengaged before engaging the capacitor
@@ -288,27 +767,71 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
       
   zappio_hv_engage_write(1);  // engage the supply before writing, under the theory that the supply is at 0
   
-  zappio_hv_setting_write(volts_to_hvdac_code((float)voltage));
-  while( !zappio_hv_ready_read() )
-    ;
-  zappio_hv_update_write(1); // commit the voltage
+  if( zap_hvctl ) {
+    hvctl_start(voltage); // hv_setting stays at 0, which is where the DAC goes if the controller lets go
+  } else {
+    zappio_hv_setting_write(mv_to_hvdac_code(voltage * 1000));
+    while( !zappio_hv_ready_read() )
+      ;
+    zappio_hv_update_write(1); // commit the voltage
+  }
 
-  // r, c already setup in arg checking
-  for( r = rstart; r < rend; r++ ) {
+  // r, c already setup in arg checking; build the visiting order
+  uint8_t row_order[4];
+  uint8_t col_order[12];
+  int nrows, ncols, ri, ci;
+  int aborted = 0;
+  uint32_t next_mj = 0;
+  uint64_t lsb_per_mj = energy_lsb_per_mj();
+  
+  if( zap_thermal ) {
+    nrows = interleave(row_order, rstart, rend);
+    ncols = interleave(col_order, cstart, cend);
+  } else {
+    for( nrows = 0; nrows < rend - rstart; nrows++ )
+      row_order[nrows] = rstart + nrows;
+    for( ncols = 0; ncols < cend - cstart; ncols++ )
+      col_order[ncols] = cstart + ncols;
+  }
+  
+  if( zap_protocol.npulses > 0 ) {
+    // protocols take the interleaved order but, like sequences, no thermal cool-downs
+    for( ri = 0; ri < nrows; ri++ ) {
+      for( ci = 0; ci < ncols; ci++ ) {
+	if( zap_protocol_well(row_order[ri], col_order[ci], max_current_code) ) {
+	  aborted = 1;
+	  goto shutdown;
+	}
+      }
+    }
+    goto shutdown;
+  }
+
+  if( zap_sequenced ) {
+    // thermal cool-downs can't be inserted mid-sequence; only the interleaved order applies
+    if( zap_sequence(row_order, nrows, col_order, ncols, voltage, depth, max_current_code, energy_cutoff, width_us) )
+      aborted = 1;
+    goto shutdown;
+  }
+  
+  for( ri = 0; ri < nrows; ri++ ) {
+    r = row_order[ri];
     
-    for( c = cstart; c < cend; c++ ) {
+    for( ci = 0; ci < ncols; ci++ ) {
+      c = col_order[ci];
+      well_start = stats_stamp();
 
-      zappio_col_write(0); // no row/col selected during main cap charging
-      zappio_row_write(0);
-      // now here we would wait until we got to the desired voltage
-      // (code to wait until the cap voltage is correct)
-      // use the monitor_acquire_write(1) API with a depth of 1 to update the instantaneous ADC readback values
-      if( wait_until_voltage(voltage) ) {
-	snprintf(ui_notifications, sizeof(ui_notifications), "Zap: charge timeout");
-	status_led = LED_STATUS_RED;
-	printf( "WARNING: timeout waiting for voltage : zwarn" );
+      if( zap_thermal ) {
+	// cool down before charging, so the discharge resistor also has its headroom back
+	int32_t cooled = thermal_cooldown(next_mj);
+	if( cooled < 0 ) {
+	  aborted = 1;
+	  goto shutdown;
+	} else if( cooled > 0 ) {
+	  printf( "Thermal cool-down of %d ms before r%d c%d : zinfo\n", cooled, r+1, c+1 );
+	}
       }
-      
+
       zappio_triggerclear_write(1);
 
       if( energy_cutoff == 0 ) { // don't use energy cutoff, but still monitor
@@ -321,37 +844,69 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
 	printf( "Energy control debug: thresh %d, ctl %x\n", (uint32_t) monitor_energy_threshold_read(), monitor_energy_control_read());
       }
       
-      // set the row/col parameters
+      // set the row/col parameters up front, and the charge comparator fires the trigger itself the moment the
+      // cap is in band. This is safe while charging: zappio holds the row/col pins at zero until the trigger
+      // latches (main() sets triggermode 0, so triggersoft can't engage them), the row/col writes themselves clear
+      // any latched trigger, and wait_until_voltage() disarms the autotrigger and drops row/col while it
+      // recovers a stalled supply
       zappio_col_write(1 << c);
       zappio_row_write(1 << r);
       last_row = r;
       last_col = c;
-  
-      // core acquisition/trigger loop
-      int acq_timer, start_time;
+
+      // start the capture free-running while the cap charges, so the pre-trigger history is already
+      // in the buffer by the time we trigger; the charge loop reads the live sample meanwhile
+      monitor_circular_write(1);
       monitor_depth_write(depth);
-      monitor_presample_write(1000); // IF THIS CHANGES -- need to update zappy.py to change the preamble compensation time
-  
-      elapsed(&acq_timer, -1);
-      start_time = acq_timer;
-      monitor_acquire_write(1); // start acquisition & trigger cycle
-      while( monitor_done_read() ) // wait for done to go 0
-	;
-      while( monitor_done_read() == 0 ) // wait for done to go back to a 1
+      monitor_presample_write(pretrigger);
+      monitor_acquire_write(1);
+      monitor_charge_ctl_write(1 << CSR_MONITOR_CHARGE_CTL_AUTOTRIGGER_OFFSET);
+      
+      if( wait_until_voltage(voltage) ) {
+	snprintf(ui_notifications, sizeof(ui_notifications), "Zap: charge timeout");
+	status_led = LED_STATUS_RED;
+	printf( "WARNING: timeout waiting for voltage : zwarn" );
+      }
+      
+      // core acquisition/trigger loop
+      phase_start = stats_stamp();
+      monitor_charge_ctl_write(1 << CSR_MONITOR_CHARGE_CTL_ENABLE_OFFSET); // disarm, in case charging timed out
+      monitor_trigger_write(1); // no-op if the comparator already fired; otherwise fires on the next sample
+      trace_event(TRACE_TRIGGER, TRACE_WELL(r, c), voltage);
+      while( monitor_done_read() == 0 ) // wait for the capture to freeze
 	; // in this loop here, we could monitor the current and stop the zap if it goes too high
-      elapsed(&acq_timer, -1);
-      int delta = acq_timer - start_time;
-      if( delta < 0 )
-	delta += timer0_reload_read();
+      uint64_t acq_ticks = systime_elapsed_since(phase_start);
+      stats_record(STATS_ACQUIRE, phase_start);
 
       // check if maxdelta current scram happened during zap
       if( zappio_maxdelta_ena_read() ) {
 	if( zappio_maxdelta_scram_read() ) {
 	  snprintf(ui_notifications, sizeof(ui_notifications), "Zap: arc on r%d c%d", r+1, c+1);
 	  status_led = LED_STATUS_RED;
-	  printf( "WARNING: max current limit hit on row %d col %d : zwarn", r+1, c+1 );
+	  printf( "WARNING: max current limit hit on row %d col %d at sample %d : zwarn", r+1, c+1,
+		  zappio_arc_sample_read() + pretrigger );
 	}
       }
+      // the slope detector runs whether or not maxdelta is enabled, and usually fires first
+      uint32_t end_cause = zappio_end_cause_read();
+      trace_event(TRACE_PULSE_END, TRACE_WELL(r, c) | end_cause << 8, zappio_end_cycles_read());
+      if( end_cause & ((1 << CSR_ZAPPIO_END_CAUSE_SLOPE_OFFSET) | (1 << CSR_ZAPPIO_END_CAUSE_ARC_OFFSET)) )
+	trace_event(TRACE_ARC, TRACE_WELL(r, c), zappio_arc_sample_read());
+      else if( end_cause & (1 << CSR_ZAPPIO_END_CAUSE_ENERGY_OFFSET) )
+	trace_event(TRACE_ENERGY_CUTOFF, TRACE_WELL(r, c), (uint32_t) monitor_energy_accumulator_read());
+      if( end_cause & (1 << CSR_ZAPPIO_END_CAUSE_SLOPE_OFFSET) ) {
+	snprintf(ui_notifications, sizeof(ui_notifications), "Zap: arc on r%d c%d", r+1, c+1);
+	status_led = LED_STATUS_RED;
+	printf( "WARNING: arc slope detected on row %d col %d at sample %d : zwarn", r+1, c+1,
+		zappio_arc_sample_read() + pretrigger );
+      }
+      // what ended the pulse, and after how long; both are cleared with the trigger
+      printf( "Pulse ended by %s after %d cycles : zinfo\n",
+	      (end_cause & (1 << CSR_ZAPPIO_END_CAUSE_SLOPE_OFFSET)) ? "arc slope" :
+	      (end_cause & (1 << CSR_ZAPPIO_END_CAUSE_ARC_OFFSET)) ? "arc scram" :
+	      (end_cause & (1 << CSR_ZAPPIO_END_CAUSE_ENERGY_OFFSET)) ? "energy cutoff" :
+	      (end_cause & (1 << CSR_ZAPPIO_END_CAUSE_TIME_OFFSET)) ? "pulse width" : "end of capture",
+	      zappio_end_cycles_read() );
       // clear the trigger; this also clears the maxdelta scram
       zappio_triggerclear_write(1);
       
@@ -359,33 +914,63 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
       zappio_col_write(0); // no row/col selected
       zappio_row_write(0);
 
-      printf("Acquisition finished in %d ticks or %d ms. Overrun status: %d : zinfo\n", delta, (delta)*1000/CONFIG_CLOCK_FREQUENCY,
+      printf("Acquisition finished in %d ticks or %d ms. Dropped samples: %d : zinfo\n", (uint32_t) acq_ticks, systime_to_ms(acq_ticks),
 	     monitor_overrun_read());
 
+      pulse_summary summary;
+      read_pulse_summary(&summary, r, c, voltage);
+      printf("Pulse: peak %d V, width %d samples at 10%%, tau %d samples : zinfo\n",
+	     (int) (adc_code_to_mv(summary.vpeak, ADC_FAST) / 1000),
+	     (summary.fall10 != SUMMARY_NONE && summary.rise10 != SUMMARY_NONE) ? (int) (summary.fall10 - summary.rise10) : -1,
+	     (summary.falltau != SUMMARY_NONE) ? (int) (summary.falltau - summary.fall90) : -1);
+
       // capacitor charges while the upload happens
       // send up 1 megabyte of data to benchmark upload speed
       unsigned int ip;
       char fname[32];
       ip = IPTOINT(host_ip_addr[0], host_ip_addr[1], host_ip_addr[2], host_ip_addr[3]);
-      // send the data dump
-      snprintf(fname, sizeof(fname), "zappy-log.r%dc%d", r+1, c+1);
-      tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)MONITOR_BASE, depth*4);
+      // send the data dump, unless the summary is all the host wants
+      if( !zap_summary_only ) {
+	phase_start = stats_stamp();
+	snprintf(fname, sizeof(fname), "zappy-log.r%dc%d", r+1, c+1);
+	tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)MONITOR_BASE, depth*4);
+	stats_record(STATS_UPLOAD_LOG, phase_start);
+      }
+      phase_start = stats_stamp();
+      snprintf(fname, sizeof(fname), "zappy-summary.r%dc%d", r+1, c+1);
+      tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)&summary, sizeof(summary));
       
-      // and store the measured energy of the run
-      char energy[32];
-      snprintf(fname, sizeof(fname), "zappy-energy.r%dc%d", r+1, c+1);
-      snprintf(energy, sizeof(energy), "%02x%08x\n", (unsigned int) (monitor_energy_accumulator_read() >> 32),
-	       (unsigned int) monitor_energy_accumulator_read());
-      tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)energy, strlen(energy));
+      // and store the measured energy of the run; the summary already carries it in energy_lo/hi
+      if( !zap_summary_only ) {
+	char energy[32];
+	snprintf(fname, sizeof(fname), "zappy-energy.r%dc%d", r+1, c+1);
+	snprintf(energy, sizeof(energy), "%02x%08x\n", (unsigned int) (monitor_energy_accumulator_read() >> 32),
+		 (unsigned int) monitor_energy_accumulator_read());
+	tftp_put(ip, DEFAULT_TFTP_SERVER_PORT, fname, (void *)energy, strlen(energy));
+      }
+      stats_record(STATS_UPLOAD_ENERGY, phase_start);
+
+      // the last well is the best predictor of the next one, all wells run at the same voltage
+      if( lsb_per_mj > 0 )
+	next_mj = (uint32_t) (monitor_energy_accumulator_read() / lsb_per_mj);
       
       // update the UI
+      phase_start = stats_stamp();
       oled_ui();
+      stats_record(STATS_UI, phase_start);
+      stats_record(STATS_WELL, well_start);
+      stats_well_next();
     }
   }
 
   // safe shutdown
+ shutdown:
   zappio_col_write(0); // no row/col selected
   zappio_row_write(0);
+  zappio_pulse_width_write(0);
+  hvctl_ctl_write(0);
+  monitor_charge_ctl_write(0);
+  monitor_circular_write(0); // a capture still free-running drops back to one-shot and ends within depth samples
   zappio_hv_setting_write(0);  // set supply to zero
   while( !zappio_hv_ready_read() )
     ;
@@ -401,6 +986,15 @@ int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16
   
   zappio_discharge_write(0);
   zappio_cap_write(0); // disengage the capacitor
+  stats_record(STATS_PLATE, plate_start);
+  trace_event(TRACE_ZAP_END, aborted, 0);
+  
+  if( aborted ) {
+    printf("Zap run aborted : zerr\n");
+    telnet_tx = 0;
+    status_led = LED_STATUS_RED;
+    return -1;
+  }
   
   // status print after safe shutdown
   printf("Run 'upload' to get a copy of the data\n");
@@ -1,5 +1,34 @@
 extern uint32_t sampledepth;
 
-// max_current_code < 0 means don't use max_current
-int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16_t max_current_code, uint32_t energy_cutoff);
+// longest single capture, in samples (us): the first half of the monitor memory (memdepth in zappy.py); the
+// sequenced plate runs split all of it between the wells
+#define ZAP_MAX_DEPTH 16384
+extern uint8_t zap_sequenced; // when set, do_zap() hands the whole run to the gateware plate sequencer
+extern uint8_t zap_thermal;     // when set, do_zap() interleaves wells and cools down against zone temperature limits
+extern uint8_t zap_hvctl;       // when set, the gateware charge controller closes the loop on the HV DAC
+extern uint8_t zap_summary_only; // when set, do_zap() uploads only the per-well pulse summary, not the waveform
+
+// multi-pulse protocol: when npulses is non-zero, do_zap() gives every well this pulse list instead of its single
+// pulse, run back to back by the gateware sequencer into one contiguous recording. The first pulse's voltage and
+// the sum of the depths stand in for do_zap()'s voltage and depth
+#define PROTOCOL_MAX_PULSES 16
+typedef struct zap_pulse {
+  uint32_t voltage;       // V
+  uint32_t depth;         // samples (us) recorded for this pulse, from its pretrigger to its end
+  uint32_t energy_cutoff; // energy accumulator counts that end the pulse, 0 runs it until the cap drains
+  uint32_t interval_us;   // minimum time from the end of the previous pulse's recording; recharging can stretch it
+  uint32_t width_us;      // row/col disengage this long after the trigger, 0 runs it until energy cutoff or depth
+} zap_pulse;
+typedef struct zap_protocol_t {
+  int npulses;
+  zap_pulse pulse[PROTOCOL_MAX_PULSES];
+} zap_protocol_t;
+extern zap_protocol_t zap_protocol;
+
+// do_zap()'s max_current_code for a current limit in mA, -1 (no limit) for a negative one
+int16_t zap_max_current_code(int32_t max_current_ma);
+// max_current_code < 0 means don't use max_current; width_us of 0 leaves the pulse width to the energy cutoff and depth
+int32_t do_zap(uint8_t row, uint8_t col, uint32_t voltage, uint32_t depth, int16_t max_current_code, uint32_t energy_cutoff,
+	       uint32_t width_us);
 uint32_t wait_until_safe(void);
+void zap_poll_bench(int n, uint32_t *min, uint32_t *max);
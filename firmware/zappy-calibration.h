@@ -2,6 +2,8 @@
 #ifndef __ZAPPY_CAL__
 #define __ZAPPY_CAL__
 
+#include <stdint.h>
+
 typedef struct _cal_record {
   char hostname[32];
   float fast_m; // y = mx + b curve for interpolating voltages
@@ -20,6 +22,18 @@ typedef struct _cal_record {
 
 extern const cal_record zappy_cal;
 
+#define ADC_SLOW 0
+#define ADC_FAST 1
+
+// integer conversion path (calibration.c); cal_init() derives its coefficients from zappy_cal and must run first
+void cal_init(void);
+uint32_t adc_code_to_mv(uint16_t code, uint8_t adc_path);
+uint16_t mv_to_adc_code(uint32_t mv, uint8_t adc_path);
+int32_t mk_code_to_mv(uint16_t code);
+uint16_t mv_to_hvdac_code(uint32_t mv);
+uint32_t ma_to_mv(uint32_t ma);
+uint64_t energy_lsb_per_mj(void);
+
 #ifndef ZAPPY_SERIAL  // allows ZAPPY_SERIAL to be specified via make D= argument
 #define ZAPPY_SERIAL  1
 #endif
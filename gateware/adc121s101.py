@@ -2,7 +2,8 @@ from migen import *
 
 from litex.soc.interconnect.csr import *
 from litex.soc.interconnect.csr_eventmanager import *
-from migen.genlib.cdc import MultiReg
+from migen.genlib.cdc import MultiReg, PulseSynchronizer
+from migen.genlib.fifo import AsyncFIFO
 
 from litex.soc.interconnect import wishbone
 
@@ -94,6 +95,78 @@ class Adc121s101(Module):
             self.dbg_sclk.eq(~self.dbg_sclk)
         ]
 
+# Free-running pair of ADC121S101s converting back to back, streamed into sys through an async FIFO
+#   adc_pads PadGroup - see Adc121s101 for spec; ADC connected to the storage cap (slow path)
+#   fadc_pads PadGroup - see Adc121s101 for spec; ADC connected to HV main (fast path)
+#   frame integer - PARAMETER "adc" cycles per conversion: cs_n is low for 16 of them and high for the rest (the quiet
+#                   time). 20 cycles at 20MHz is 1 MSPS, the ADC121S101's maximum throughput
+#   self.*adc_data* `Signal(12)` - OUTPUT - slow ADC code, valid with strobe (sys domain)
+#   self.*fadc_data* `Signal(12)` - OUTPUT - fast ADC code from the same frame, valid with strobe (sys domain)
+#   self.*strobe* `Signal()` - OUTPUT - single-cycle pulse for each new sample pair (sys domain)
+#   self.*dropped* `Signal()` - OUTPUT - single-cycle pulse when a sample pair was lost to a full FIFO (sys domain)
+#   "adc" `Clock` (implicit) - CLOCK conversions run in the "adc" domain, should be at 20MHz
+#
+#   Both converters share one frame counter, so each pair is sampled on the same edge. The bit timing within a
+#   frame is the same as Adc121s101's, which needs an acquire handshake per sample instead.
+class Adc121s101Stream(Module):
+    def __init__(self, adc_pads, fadc_pads, frame=20):
+        assert frame >= 17  # 16 cycles of conversion plus at least one of quiet time
+        self.adc_data = Signal(12)
+        self.fadc_data = Signal(12)
+        self.strobe = Signal()
+        self.dropped = Signal()
+
+        fc = Signal(max=frame)
+        adc_shift = Signal(12)
+        fadc_shift = Signal(12)
+        self.sync.adc += [
+            If(fc == (frame - 1),
+               fc.eq(0),
+            ).Else(
+               fc.eq(fc + 1),
+            ),
+            adc_pads.cs_n.eq(fc >= 16),  # registered, so cs_n is low for cycles 1-16 of the frame
+            fadc_pads.cs_n.eq(fc >= 16),
+            If((fc >= 4) & (fc <= 15),  # 3 leading zeros, then 12 bits MSB first
+               adc_shift.eq(Cat(adc_pads.dout, adc_shift[:11])),
+               fadc_shift.eq(Cat(fadc_pads.dout, fadc_shift[:11])),
+            ),
+        ]
+
+        fifo = ClockDomainsRenamer({"write": "adc", "read": "sys"})(AsyncFIFO(24, 8))
+        self.submodules += fifo
+        self.comb += [
+            fifo.we.eq(fc == 16),
+            fifo.din.eq(Cat(adc_shift, fadc_shift)),
+            fifo.re.eq(1),  # sys is 5x faster than the frame rate, so the FIFO only ever holds the crossing
+            self.strobe.eq(fifo.readable),
+            self.adc_data.eq(fifo.dout[:12]),
+            self.fadc_data.eq(fifo.dout[12:24]),
+        ]
+        self.submodules.drop_sync = PulseSynchronizer("adc", "sys")
+        self.comb += [
+            self.drop_sync.i.eq(fifo.we & ~fifo.writable),
+            self.dropped.eq(self.drop_sync.o),
+        ]
+
+        # generate the clocks, same as Adc121s101
+        for pads in [adc_pads, fadc_pads]:
+            self.specials += [
+                Instance("ODDR2",
+                         p_DDR_ALIGNMENT="NONE",
+                         p_INIT="0",
+                         p_SRTYPE="SYNC",
+
+                         o_Q=getattr(pads, "sclk"),
+                         i_C0=ClockSignal("adc"),
+                         i_C1=~ClockSignal("adc"),
+                         i_D0=1,
+                         i_D1=0,
+                         i_R=ResetSignal("adc"),
+                         i_S=0,
+                ),
+            ]
+
 # CSR wrapper for the Adc121s101 module
 #   pads PadGroup - see Adc121s101 for spec
 #   CSR acquire (wo) - writing anything to this bit triggers an acquisition. Ignores acquire when valid is not set.
@@ -146,6 +219,118 @@ class Adc121s101_csr(Module, AutoCSR):
                 )
         )
 
+# Streaming pulse metrics, updated as each post-trigger sample of a capture arrives, so the host can skip the
+# waveform upload and still get the numbers it would have computed from it. Voltages are ADC codes (slow path is
+# the storage cap, fast path is HV main); times are in samples from the trigger sample.
+#   self.*slow* `Signal(12)` - INPUT - slow ADC code of the current sample
+#   self.*fast* `Signal(12)` - INPUT - fast ADC code of the current sample
+#   self.*strobe* `Signal()` - INPUT - single-cycle pulse for each sample inside the pulse window (trigger onward)
+#   self.*reset* `Signal()` - INPUT - single-cycle pulse clears all metrics, at the start of a capture
+#   CSR samples (ro, 16) - samples seen in the pulse window
+#   CSR v0 (ro, 12) - slow code at the trigger sample: the cap voltage the pulse started from, and the 100% reference
+#                     for the crossings below
+#   CSR vend (ro, 12) - slow code at the last sample
+#   CSR vpeak (ro, 12) - maximum fast code
+#   CSR vmin (ro, 12) - minimum fast code once fast has reached 90% of v0 (the residual at the end of the pulse)
+#   CSR ipeak (ro, 12) - maximum of slow - fast, i.e. peak current times capres, in codes
+#   CSR charge (ro, 32) - sum of slow - fast over the window, i.e. delivered charge times capres, in code-samples
+#   CSR rise10, rise90 (ro, 16) - first sample where fast reached 10%/90% of v0
+#   CSR fall90, fall10 (ro, 16) - first sample after the matching rise where fast dropped below 90%/10% of v0
+#   CSR falltau (ro, 16) - first sample after fall90 where fast dropped below 90%/e of v0; falltau - fall90 is the
+#                          decay time constant. All crossing times read 0xFFFF if the crossing never happened
+class PulseMetrics(Module, AutoCSR):
+    def __init__(self):
+        self.slow = Signal(12)
+        self.fast = Signal(12)
+        self.strobe = Signal()
+        self.reset = Signal()
+
+        self.samples = CSRStatus(16)
+        self.v0 = CSRStatus(12)
+        self.vend = CSRStatus(12)
+        self.vpeak = CSRStatus(12)
+        self.vmin = CSRStatus(12)
+        self.ipeak = CSRStatus(12)
+        self.charge = CSRStatus(32)
+        self.rise10 = CSRStatus(16)
+        self.rise90 = CSRStatus(16)
+        self.fall90 = CSRStatus(16)
+        self.fall10 = CSRStatus(16)
+        self.falltau = CSRStatus(16)
+
+        # crossing levels as fractions of v0, Q12: 10% = 410/4096, 90%/e = 1356/4096
+        thr10 = Signal(12)
+        thr90 = Signal(12)
+        thrtau = Signal(12)
+        tenth = Signal(24)
+        tau = Signal(24)
+        self.comb += [
+            tenth.eq(self.v0.status * 410),
+            tau.eq(self.v0.status * 1356),
+            thr10.eq(tenth[12:24]),
+            thr90.eq(self.v0.status - tenth[12:24]),
+            thrtau.eq(tau[12:24]),
+        ]
+
+        current = Signal(12)
+        self.comb += If(self.slow > self.fast,  # inverted during discharge is noise, same as Zappy_adc delta
+                        current.eq(self.slow - self.fast),
+                     ).Else(
+                        current.eq(0),
+                     )
+
+        first = Signal()
+        self.comb += first.eq(self.samples.status == 0)
+        none = 0xFFFF
+        crossings = [self.rise10, self.rise90, self.fall90, self.fall10, self.falltau]
+        self.sync += [
+            If(self.reset,
+               self.samples.status.eq(0),
+               self.v0.status.eq(0),
+               self.vend.status.eq(0),
+               self.vpeak.status.eq(0),
+               self.vmin.status.eq(0xFFF),
+               self.ipeak.status.eq(0),
+               self.charge.status.eq(0),
+               [c.status.eq(none) for c in crossings],
+            ).Elif(self.strobe,
+               If(self.samples.status != 0xFFFF,
+                  self.samples.status.eq(self.samples.status + 1),
+               ),
+               self.vend.status.eq(self.slow),
+               self.charge.status.eq(self.charge.status + current),
+               If(self.fast > self.vpeak.status,
+                  self.vpeak.status.eq(self.fast),
+               ),
+               If(current > self.ipeak.status,
+                  self.ipeak.status.eq(current),
+               ),
+               If(first,
+                  # row/col only engage on the trigger sample, so it sets the reference and crossings start on the next one
+                  self.v0.status.eq(self.slow),
+               ).Else(
+                  If((self.rise90.status != none) & (self.fast < self.vmin.status),
+                     self.vmin.status.eq(self.fast),
+                  ),
+                  If((self.rise10.status == none) & (self.fast >= thr10),
+                     self.rise10.status.eq(self.samples.status),
+                  ),
+                  If((self.rise90.status == none) & (self.fast >= thr90),
+                     self.rise90.status.eq(self.samples.status),
+                  ),
+                  If((self.rise90.status != none) & (self.fall90.status == none) & (self.fast < thr90),
+                     self.fall90.status.eq(self.samples.status),
+                  ),
+                  If((self.rise10.status != none) & (self.fall10.status == none) & (self.fast < thr10),
+                     self.fall10.status.eq(self.samples.status),
+                  ),
+                  If((self.fall90.status != none) & (self.falltau.status == none) & (self.fast < thrtau),
+                     self.falltau.status.eq(self.samples.status),
+                  ),
+               )
+            )
+        ]
+
 # FIFO wrapper for the Adc121s101 module
 #   hvmain_pads PadGroup - see Adc121s101 for spec; ADC connected to HV main
 #   cap_pads PadGroup - see Adc121s101 for spec; ADC connected to storage cap
@@ -158,34 +343,105 @@ class Adc121s101_csr(Module, AutoCSR):
 #   CSR depth (wo, 16) - depth of samples to acquire into buffer
 #   CSR done (ro) - high when acquisition is finished
 #   CSR int_ena (wo) - enable generation of interrupt when done goes high
-#   CSR period (wo, 32) - sampling period for depth > 1 sampling, period specified in SYSCLK increments. Should be > 1us.
-#   CSR overrun (ro, 32) - number of clock cycles sample timer was overrun on the very most recent sample acquired
+#   CSR period (wo, 32) - decimation factor: one of every period samples of the free-running 1 MSPS stream is used
+#                         (captured, compared, reported). 0 and 1 both use every sample, i.e. a 1us sample period
+#   CSR overrun (ro, 32) - samples dropped by the stream since the last capture started; should always read 0
 #   CSR presample (wo, 16) - number of samples to wait before issuing a trigger. It is up to software to ensure depth > presample
+#                            In circular mode, the number of pre-trigger samples kept ahead of the trigger sample; must be < depth - 1
+#   CSR circular (wo) - when set, acquire starts a free-running capture that wraps at depth and only ends after a trigger
+#   CSR trigger (wo) - circular mode only: writing anything fires ext_trigger on the next sample (once presample samples
+#                      of history exist), then the buffer freezes depth - presample - 1 samples later
+#   CSR start (ro, 16) - oldest sample address when the capture froze. Wishbone reads are rotated by this amount so the
+#                        buffer always reads out oldest-first, with the trigger sample at index presample (0 in one-shot mode)
 #   self.*ext_trigger* `Signal()` - OUTPUT - single-cycle pulse to indicate when external trigger event should happen based on presample
-#   CSR cur_adc (ro, 12) - latest adc value, guaranteed atomic fadc during "acquire" -- for computing/trapping high current conditions
-#   CSR cur_fadc (ro, 12) - latest fadc value, guaranteed atomic with adc during "acquire"
+#   CSR cur_adc (ro, 12) - latest adc value, updated every (decimated) sample whether or not a capture is running;
+#                          atomic with fadc -- for computing/trapping high current conditions
+#   CSR cur_fadc (ro, 12) - latest fadc value, atomic with adc
 #   CSR delta (ro, 16) - difference between adc and fadc
-
-#   MEMORY block on wishbone is generated by this module
+#   CSR charge_target (wo, 12) - slow ADC code the storage cap is being charged to
+#   CSR charge_band (wo, 12) - tolerance either side of charge_target, in codes
+#   CSR charge_over_band (wo, 12) - codes above charge_target at which charge_over is flagged; 0 uses charge_band. Lets
+#                                   the overshoot warning stay tighter than a wide low-voltage charge band
+#   CSR charge_settle (wo, 8) - consecutive in-band samples before charged is raised
+#   CSR charge_ctl (wo, 2) - bit 0 enable: compare every slow sample, captured or not. bit 1 autotrigger: the charged
+#                            edge arms the circular trigger
+#   CSR charged (ro) - the cap has been in band for charge_settle samples; also raises the charged event
+#   CSR charge_over (ro) - the latest slow sample is above charge_target + charge_over_band
+#   self.*charged_out* `Signal()` - OUTPUT - same as the charged CSR, for gating other blocks
+#   self.*slow_sample* `Signal(12)` - OUTPUT - latest slow ADC code
+#   self.*slow_strobe* `Signal()` - OUTPUT - single-cycle pulse when slow_sample, fast_sample and livedelta are new
+#   self.*fast_sample* `Signal(12)` - OUTPUT - latest fast ADC code
+#   metrics PulseMetrics - streaming metrics of the pulse in each capture, CSRs under metrics_ (see PulseMetrics)
+
+#   self.*seq_active* `Signal()` - INPUT - a ZapSequencer owns the capture: seq_* below replace the depth, energy
+#                                  threshold and energy enable CSRs, circular mode is ignored and the acquire CSR is ignored
+#   self.*seq_acquire* `Signal()` - INPUT - single-cycle pulse starts a one-shot capture while seq_active
+#   self.*seq_depth* `Signal(16)` - INPUT - samples to capture
+#   self.*seq_base* `Signal(log2(memdepth))` - INPUT - word address of the first sample, so each well lands in its own region
+#   self.*seq_threshold* `Signal(40)` - INPUT - energy cutoff threshold
+#   self.*seq_cutoff_ena* `Signal()` - INPUT - use the energy cutoff
+#   self.*seq_energy_reset* `Signal()` - INPUT - single-cycle pulse resets the energy accumulator
+#   self.*seq_charge_target* `Signal(12)`, self.*seq_charge_band* `Signal(12)` - INPUT - per-pulse charge comparator
+#                                  target and band while seq_active; 0 falls back to the CSR
+#   self.*charge_target_out* `Signal(12)` - OUTPUT - the target the comparator is using, for the charge controller
+
+#   MEMORY block on wishbone is generated by this module, CPU-writable while no capture is running
 class Zappy_adc(Module, AutoCSR):
     def __init__(self, adc_pads, fadc_pads, memdepth=8192):
-        self.submodules.adc = Adc121s101(adc_pads)
-        self.submodules.fadc = Adc121s101(fadc_pads)
+        self.submodules.stream = Adc121s101Stream(adc_pads, fadc_pads)
 
         self.acquire = CSRStorage(1)
         self.depth = CSRStorage(16)
         self.done = CSRStatus()
         self.int_ena = CSRStorage(1) # enable interrupt on done
-        self.period = CSRStorage(32)  # number of clock cycles to elapse for each sampling period
-        self.overrun = CSRStatus(32) # amount that the sampling timer was overrun, if any
-        # this should be longer than the sampling rate of the ADC or else timing could be uneven
+        self.period = CSRStorage(32, reset=1)  # decimation of the 1 MSPS stream
+        self.overrun = CSRStatus(32) # samples dropped by the stream
         self.presample = CSRStorage(16)
+        self.circular = CSRStorage(1)
+        self.trigger = CSRStorage(1)
+        self.start = CSRStatus(16)
+        self.charge_target = CSRStorage(12)
+        self.charge_band = CSRStorage(12)
+        self.charge_over_band = CSRStorage(12)
+        self.charge_settle = CSRStorage(8, reset=8)
+        self.charge_ctl = CSRStorage(fields=[
+            CSRField("enable", size=1, description="Run the charge comparator, sampling while idle"),
+            CSRField("autotrigger", size=1, description="Arm the circular-mode trigger when charged is reached"),
+        ])
+        self.charged = CSRStatus()
+        self.charge_over = CSRStatus()
+        self.charged_out = Signal()
+        self.slow_sample = Signal(12)
+        self.slow_strobe = Signal()
+        self.fast_sample = Signal(12)
         self.ext_trigger = Signal()
         self.cur_adc = CSRStatus(12)
         self.cur_fadc = CSRStatus(12)
         self.delta = CSRStatus(16)
         self.livedelta = Signal(16)
 
+        self.seq_active = Signal()
+        self.seq_acquire = Signal()
+        self.seq_depth = Signal(16)
+        self.seq_base = Signal(log2_int(memdepth))
+        self.seq_threshold = Signal(40)
+        self.seq_cutoff_ena = Signal()
+        self.seq_energy_reset = Signal()
+        self.seq_charge_target = Signal(12)
+        self.seq_charge_band = Signal(12)
+        self.charge_target_out = Signal(12)
+        depth = Signal(16)
+        circular = Signal()
+        self.comb += [
+            If(self.seq_active,
+               depth.eq(self.seq_depth),
+               circular.eq(0),
+            ).Else(
+               depth.eq(self.depth.storage),
+               circular.eq(self.circular.storage),
+            )
+        ]
+
         # coefficient is roughly 1.69*10^-9 joules per LSB
         # max possible energy is 10 Joules, so max count is approx 5.9 billion -- longer than a 32 bit number
         self.energy_accumulator = CSRStatus(fields=[
@@ -203,7 +459,7 @@ class Zappy_adc(Module, AutoCSR):
         sadc_reg = Signal(12)
         self.energy_cutoff  = Signal()  # cut off the zap because energy is past the threshold
         self.sync += [
-            If(self.energy_control.fields.reset,
+            If(self.energy_control.fields.reset | self.seq_energy_reset,
                self.energy_accumulator.fields.energy.eq(0)
             ).Else(
                 If(energy_accumulate & (sadc_reg > fadc_reg), # negative results are due to small static offsets, causes instability problems if we sume them in
@@ -212,8 +468,8 @@ class Zappy_adc(Module, AutoCSR):
                     self.energy_accumulator.fields.energy.eq(self.energy_accumulator.fields.energy)
                 )
             ),
-            If(self.energy_control.fields.enable,
-                If( (self.energy_threshold.fields.threshold < self.energy_accumulator.fields.energy) &
+            If(Mux(self.seq_active, self.seq_cutoff_ena, self.energy_control.fields.enable),
+                If( (Mux(self.seq_active, self.seq_threshold, self.energy_threshold.fields.threshold) < self.energy_accumulator.fields.energy) &
                     (self.energy_accumulator.fields.energy[self.energy_accumulator.fields.energy.nbits - 1] == 0), # only trigger if energy is not negative
                   # note: negative energy can happen due to static offsets at low energy levels
                   self.energy_cutoff.eq(1)
@@ -225,9 +481,17 @@ class Zappy_adc(Module, AutoCSR):
             )
         ]
 
+        self.submodules.metrics = PulseMetrics()
+        self.comb += [
+            self.metrics.slow.eq(sadc_reg),
+            self.metrics.fast.eq(fadc_reg),
+            self.metrics.strobe.eq(energy_accumulate), # same window as the energy accumulator
+        ]
+
         # also generate a convenience interrupt when status is done, if interrupt is enabled
         self.submodules.ev = EventManager()
         self.ev.acquisition_done = EventSourcePulse()
+        self.ev.charged = EventSourcePulse()
         self.ev.finalize()
         self.comb += self.ev.acquisition_done.trigger.eq(self.done.status & self.int_ena.storage)
 
@@ -235,11 +499,48 @@ class Zappy_adc(Module, AutoCSR):
         port = mem.get_port(write_capable=True)
         self.specials += port
         self.adr = adr = Signal(log2_int(memdepth))  # should be measured in dw-width words
+        base = Signal(log2_int(memdepth))  # region offset of the current capture, 0 unless sequenced
         data = Signal(32)
         we = Signal()
 
+        # decimate the stream: every period-th sample is registered, then sample_strobe pulses for it
+        sample_strobe = Signal()
+        dec_count = Signal(32)
+        dec_strobe = Signal()
+        zeropad = Signal(4)
+        self.comb += [
+            dec_strobe.eq(self.stream.strobe & ((dec_count + 1) >= self.period.storage)),
+            zeropad.eq(0),
+        ]
+        self.sync += [
+            If(self.stream.strobe,
+               If(dec_strobe,
+                  dec_count.eq(0),
+               ).Else(
+                  dec_count.eq(dec_count + 1),
+               )
+            ),
+            sample_strobe.eq(dec_strobe),
+            If(dec_strobe,
+               data.eq(Cat(self.stream.adc_data, zeropad, self.stream.fadc_data, zeropad)), # stable copy for RAM
+               fadc_reg.eq(self.stream.fadc_data),  # also make a copy for the energy accumulator
+               sadc_reg.eq(self.stream.adc_data),
+               self.cur_adc.status.eq(self.stream.adc_data),
+               self.cur_fadc.status.eq(self.stream.fadc_data),
+               If(self.stream.fadc_data < self.stream.adc_data,  # in discharge, adc should be higher than fadc
+                  self.livedelta.eq(self.stream.adc_data - self.stream.fadc_data),
+                  self.delta.status.eq(self.stream.adc_data - self.stream.fadc_data),
+               ).Else(
+                  self.livedelta.eq(0),  # don't go negative, if inverted during discharge, it's noise
+                  self.delta.status.eq(0),
+               )
+            )
+        ]
+
+        # sysclk cycles since the last sample, for the analyzer
         self.sampletimer = sampletimer = Signal(32)
         self.sample_reset = sample_reset = Signal()
+        self.comb += sample_reset.eq(sample_strobe)
         self.sync += [
             If(sample_reset,
                sampletimer.eq(0),
@@ -252,98 +553,184 @@ class Zappy_adc(Module, AutoCSR):
         self.submodules.fsm = fsm
 
         self.count = count = Signal(16)
-        zeropad = Signal(4)
-        self.comb += zeropad.eq(0)
+        filled = Signal(16)  # samples written since acquire, saturating at depth
+        trigger_pending = Signal()
+        self.triggered = triggered = Signal()
+        next_adr = Signal(log2_int(memdepth))
+        self.comb += [
+            If(circular & (adr == (depth - 1)),
+               next_adr.eq(0),
+            ).Else(
+               next_adr.eq(adr + 1),
+            )
+        ]
+        # charge-complete comparator, evaluated once per slow sample
+        settle_count = Signal(8)
+        charged_rise = Signal()
+        target = self.charge_target_out
+        band = Signal(12)
+        over_band = Signal(12)
+        target_r = Signal(12)
+        self.comb += [
+            If(self.seq_active & (self.seq_charge_target != 0),
+               target.eq(self.seq_charge_target),
+            ).Else(
+               target.eq(self.charge_target.storage),
+            ),
+            If(self.seq_active & (self.seq_charge_band != 0),
+               band.eq(self.seq_charge_band),
+            ).Else(
+               band.eq(self.charge_band.storage),
+            ),
+            If(self.charge_over_band.storage != 0,
+               over_band.eq(self.charge_over_band.storage),
+            ).Else(
+               over_band.eq(band),
+            ),
+            self.slow_sample.eq(sadc_reg),
+            self.slow_strobe.eq(sample_strobe),
+            self.fast_sample.eq(fadc_reg),
+            self.charged.status.eq(self.charge_ctl.fields.enable & (settle_count >= self.charge_settle.storage)),
+            self.charged_out.eq(self.charged.status),
+        ]
+        self.sync += [
+            target_r.eq(target),
+            If(~self.charge_ctl.fields.enable | (target != target_r), # a new target restarts the settle count
+               settle_count.eq(0),
+               self.charge_over.status.eq(0),
+            ).Elif(sample_strobe,
+               self.charge_over.status.eq(sadc_reg > (target + over_band)),
+               If(((sadc_reg + band) >= target) &
+                  (sadc_reg <= (target + band)),
+                  If(settle_count != 0xFF,
+                     settle_count.eq(settle_count + 1),
+                  )
+               ).Else(
+                  settle_count.eq(0),
+               )
+            )
+        ]
+        self.comb += [
+            charged_rise.eq(sample_strobe & self.charge_ctl.fields.enable & ~self.charged.status &
+                            ((settle_count + 1) == self.charge_settle.storage) &
+                            ((sadc_reg + band) >= target) &
+                            (sadc_reg <= (target + band))),
+            self.ev.charged.trigger.eq(charged_rise),
+        ]
+
+        self.sync += [
+            If(self.acquire.re,
+               trigger_pending.eq(0),
+            ).Elif(self.trigger.re | (charged_rise & self.charge_ctl.fields.autotrigger),
+               trigger_pending.eq(1),
+            )
+        ]
+
+        # a capture request can land while the previous capture is finishing, so hold it until IDLE takes it
+        start_req = Signal()
+        start_pending = Signal()
+        self.comb += start_req.eq((self.acquire.re & ~self.seq_active) | (self.seq_acquire & self.seq_active))
+        self.sync += [
+            If(fsm.ongoing("IDLE"), # IDLE acts on start_req directly
+               start_pending.eq(0),
+            ).Elif(start_req,
+               start_pending.eq(1),
+            ),
+            If(start_req & fsm.ongoing("IDLE"),
+               self.overrun.status.eq(0),
+            ).Elif(self.stream.dropped & (self.overrun.status != 0xFFFFFFFF),
+               self.overrun.status.eq(self.overrun.status + 1),
+            )
+        ]
 
-        adc_valid_sync = Signal()
-        fadc_valid_sync = Signal()
-        self.specials += MultiReg(self.adc.valid, adc_valid_sync)
-        self.specials += MultiReg(self.fadc.valid, fadc_valid_sync)
-        pulsetimer = Signal(5)
         fsm.act("IDLE",
-                NextValue(count, self.depth.storage),
+                NextValue(count, depth),
                 NextValue(adr, 0),
-                NextValue(pulsetimer, 0),
-                If(self.acquire.re,
-                   NextState("ACQUIRE"),
-                   sample_reset.eq(1), # reset & run the sample counter from 0
+                NextValue(filled, 0),
+                NextValue(triggered, 0),
+                If(start_req | start_pending,
+                   NextState("WAITSAMPLE"),
+                   NextValue(base, Mux(self.seq_active, self.seq_base, 0)),
+                   self.metrics.reset.eq(1),
                    NextValue(self.done.status, 0), # clear status to 0
+                   NextValue(self.start.status, 0),
                 )
         )
-        fsm.act("ACQUIRE",  # send an acquire pulse, must be long enough for the ADC module to pick it up
-                self.adc.acquire.eq(1),
-                self.fadc.acquire.eq(1),
-                NextValue(pulsetimer, pulsetimer + 1),
-                If(pulsetimer >= 15,
-                    NextState("WAITVALID"),
-                    NextValue(self.adc.ready, 1),
-                    NextValue(self.fadc.ready, 1),
-                )
-        )
-        fsm.act("WAITVALID", # wait for ADC to present valid data, then copy it to the data register
-                NextValue(pulsetimer, 0), # reset the pulse timer in case we loop back to ACQUIRE state without going through IDLE
-                If(adc_valid_sync & fadc_valid_sync,
-                   NextValue(data, Cat(self.adc.data, zeropad, self.fadc.data, zeropad)), # stable copy for RAM
-                   NextValue(fadc_reg, self.fadc.data),  # also make a copy for the energy accumulator
-                   NextValue(sadc_reg, self.adc.data),
-                   NextValue(self.cur_adc.status, self.adc.data),
-                   NextValue(self.cur_fadc.status, self.fadc.data),
-                   NextValue(self.adc.ready, 0),
-                   NextValue(self.fadc.ready, 0),
-                   NextState("SAMPLING_WAIT"),
-                   If(self.fadc.data < self.adc.data,  # in discharge, adc should be higher than fadc
-                      NextValue(self.livedelta, self.adc.data - self.fadc.data),
-                      NextValue(self.delta.status, self.adc.data - self.fadc.data),
-                    ).Else(
-                       NextValue(self.livedelta, 0),  # don't go negative, if inverted during discharge, it's noise
-                       NextValue(self.delta.status, 0),
-                   )
+        fsm.act("WAITSAMPLE", # the stream registers each sample into data/sadc_reg/fadc_reg, then strobes
+                If(sample_strobe,
+                   we.eq(1),  # commit the data to RAM
+                   NextState("INCREMENT"),
                 )
         )
-        fsm.act("SAMPLING_WAIT", # wait until the next sample period
-                we.eq(1),  # commit the data to RAM
-                # the >= catches the case that waiting for the ADC to finish took longer than the specified period
-                If(sampletimer >= (self.period.storage-2),
-                   NextState("INCREMENT")
-                ),
-                # note the statement above is >=, so if sampletimer starts below period, the next
-                # statement won't happen and the overrun will be 0
-                # this statement runs in parallel with the above statement.
-                If(sampletimer > (self.period.storage-2),
-                   NextValue(self.overrun.status, sampletimer - self.period.storage)
-                ).Else(
-                    NextValue(self.overrun.status, 0)
-                ),
-        )
         fsm.act("INCREMENT", # single cycle in sysclk
-                If(count < (self.depth.storage - self.presample.storage),
-                     self.ext_trigger.eq(1),
-                     energy_accumulate.eq(1),
-                   ),
-                NextValue(count, count - 1),
-                NextValue(adr, adr + 1),
-                If(count != 0,
-                   NextState("ACQUIRE"),
-                   sample_reset.eq(1),
+                If(~circular,
+                    NextValue(adr, next_adr),
+                    If(count < (depth - self.presample.storage),
+                         self.ext_trigger.eq(1),
+                         energy_accumulate.eq(1),
+                       ),
+                    NextValue(count, count - 1),
+                    If(count != 0,
+                       NextState("WAITSAMPLE"),
+                    ).Else(
+                       NextState("IDLE"),
+                       NextValue(self.done.status, 1), # indicate status is done
+                    )
                 ).Else(
-                   NextState("IDLE"),
-                   NextValue(self.done.status, 1), # indicate status is done
+                    # circular: run until triggered, then freeze once the post-trigger samples are in
+                    NextValue(adr, next_adr),
+                    If(filled != depth,
+                       NextValue(filled, filled + 1),
+                    ),
+                    If(triggered,
+                        self.ext_trigger.eq(1),
+                        energy_accumulate.eq(1),
+                        NextValue(count, count - 1),
+                    ).Elif(trigger_pending & (filled >= self.presample.storage), # sample just written becomes the trigger sample
+                        self.ext_trigger.eq(1),
+                        energy_accumulate.eq(1),
+                        NextValue(triggered, 1),
+                        NextValue(count, depth - self.presample.storage - 1),
+                    ),
+                    If( (triggered & (count == 1)) |
+                        (~triggered & trigger_pending & (filled >= self.presample.storage) &
+                            ((depth - self.presample.storage) == 1)),
+                       NextState("IDLE"),
+                       NextValue(self.done.status, 1),
+                       NextValue(self.start.status, next_adr), # oldest sample is the next one we would have overwritten
+                    ).Else(
+                       NextState("WAITSAMPLE"),
+                    )
                 )
         )
 
         self.comb += [
-            port.adr.eq(adr),
+            port.adr.eq(adr + base),
             port.dat_w.eq(data),
             port.we.eq(we)
         ]
 
         self.bus = wishbone.Interface()
-        self.submodules.wb_sram_if = wishbone.SRAM(mem, read_only=True)
+        # writable from the CPU as well, so the firmware's netboot can stage a whole main_ram image in it
+        self.submodules.wb_sram_if = wishbone.SRAM(mem, read_only=False)
+
+        # rotate accesses by start, wrapping at depth, so a circular capture reads out oldest-first
+        view = wishbone.Interface()
+        view_adr = Signal(log2_int(memdepth) + 1)
+        self.comb += [
+            view.connect(self.wb_sram_if.bus, omit={"adr"}),
+            view_adr.eq(view.adr[:log2_int(memdepth)] + self.start.status),
+            If((self.start.status != 0) & (view_adr >= self.depth.storage),
+               self.wb_sram_if.bus.adr.eq(view_adr - self.depth.storage),
+            ).Else(
+               self.wb_sram_if.bus.adr.eq(view_adr),
+            )
+        ]
 
         decoder_offset = log2_int(memdepth, need_pow2=False)
         def slave_filter(a):
                 return a[decoder_offset:32-decoder_offset] == 0  # no aliasing in the block
-        wb_con = wishbone.Decoder(self.bus, [(slave_filter, self.wb_sram_if.bus)], register=True)
+        wb_con = wishbone.Decoder(self.bus, [(slave_filter, view)], register=True)
         self.submodules += wb_con
 
 
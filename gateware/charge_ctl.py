@@ -0,0 +1,163 @@
+from migen import *
+
+from litex.soc.interconnect.csr import *
+
+# Closed-loop HV charge controller: trims the HV DAC from the monitor's slow (storage cap) samples
+#   self.*sample* `Signal(12)` - INPUT - latest slow ADC code
+#   self.*strobe* `Signal()` - INPUT - single-cycle pulse when sample is new
+#   self.*target* `Signal(12)` - INPUT - slow ADC code to charge to (the monitor's charge_target)
+#   self.*hold* `Signal()` - INPUT - freeze the loop, e.g. while the row/col are engaged and the cap is discharging
+#   self.*dac_ready* `Signal()` - INPUT - the DAC can take a new code
+#   self.*ff_code* `Signal(16)` - INPUT - when nonzero, replaces the feedforward CSR (per-pulse setpoint from a sequencer protocol)
+#   self.*code* `Signal(16)` - OUTPUT - DAC code, held stable between updates
+#   self.*update* `Signal()` - OUTPUT - single-cycle pulse to send code to the DAC
+#   self.*active* `Signal()` - OUTPUT - the controller owns the DAC (enabled and not faulted); when it drops, the DAC
+#                                  owner (Zappio) goes back to its own setting
+#   CSR ctl (wo, 1) - enable; writing it (either value) clears a fault and restarts from the boost phase.
+#                     Each recharge after hold drops also restarts from the boost phase.
+#   CSR feedforward (wo, 16) - DAC code expected to hold the target voltage, the operating point the PI terms trim around
+#   CSR boost (wo, 16) - DAC code applied until the cap is within trim_window codes of target
+#   CSR trim_window (wo, 12) - distance below target where the boost phase hands over to the PI loop
+#   CSR kp (wo, 16) - proportional gain, 8.8 fixed point, DAC codes per ADC code of error
+#   CSR ki (wo, 16) - integral gain, 8.8 fixed point, DAC codes per accumulated ADC code of error
+#   CSR code_max (wo, 16) - clamp on the DAC code the loop may request
+#   CSR interval (wo, 8) - slow samples between DAC updates, since a DAC8560 write takes a few microseconds
+#   CSR fault_window (wo, 16) - samples over which the cap must rise while more than trim_window below target
+#   CSR fault_min_rise (wo, 12) - minimum rise over fault_window; less than this (supply in OC/foldback) latches fault
+#   CSR fault (ro) - the supply stopped charging the cap; the controller lets go of the DAC until ctl is written again
+#   CSR boosting (ro) - still in the boost phase
+#   CSR dac_code (ro, 16) - the code most recently sent to the DAC
+class ChargeController(Module, AutoCSR):
+    def __init__(self):
+        self.sample = Signal(12)
+        self.strobe = Signal()
+        self.target = Signal(12)
+        self.hold = Signal()
+        self.dac_ready = Signal()
+        self.ff_code = Signal(16)
+        self.code = Signal(16)
+        self.update = Signal()
+        self.active = Signal()
+
+        self.ctl = CSRStorage(1)
+        self.feedforward = CSRStorage(16)
+        self.boost = CSRStorage(16)
+        self.trim_window = CSRStorage(12, reset=40)
+        self.kp = CSRStorage(16, reset=0x0200)
+        self.ki = CSRStorage(16, reset=0x0010)
+        self.code_max = CSRStorage(16, reset=0xFFFF)
+        self.interval = CSRStorage(8, reset=8)
+        self.fault_window = CSRStorage(16, reset=20000)
+        self.fault_min_rise = CSRStorage(12, reset=4)
+        self.fault = CSRStatus(1)
+        self.boosting = CSRStatus(1)
+        self.dac_code = CSRStatus(16)
+
+        enable = self.ctl.storage[0]
+        self.comb += [
+            self.active.eq(enable & ~self.fault.status),
+            self.dac_code.status.eq(self.code),
+        ]
+
+        # fault detection: while still well below target (boost region) and not held, the cap has to keep rising
+        window_count = Signal(16)
+        window_start = Signal(12)
+        self.sync += [
+            If(self.ctl.re | ~enable | self.hold | (self.sample + self.trim_window.storage >= self.target),
+               window_count.eq(0),
+               window_start.eq(self.sample),
+               If(self.ctl.re,
+                  self.fault.status.eq(0),
+               )
+            ).Elif(self.strobe,
+               If(window_count >= self.fault_window.storage,
+                  If(self.sample < (window_start + self.fault_min_rise.storage),
+                     self.fault.status.eq(1),
+                  ),
+                  window_count.eq(0),
+                  window_start.eq(self.sample),
+               ).Else(
+                  window_count.eq(window_count + 1),
+               )
+            )
+        ]
+
+        # PI loop, one step per interval samples, pipelined over a few cycles to keep the multipliers off the critical path
+        err = Signal((13, True))
+        integ = Signal((18, True))
+        p_term = Signal((30, True))
+        i_term = Signal((35, True))
+        total = Signal((37, True))
+        sample_count = Signal(8)
+        integ_max = 2**17 - 1
+        hold_r = Signal()
+        self.sync += hold_r.eq(self.hold)
+
+        fsm = FSM(reset_state="IDLE")
+        self.submodules.fsm = fsm
+        fsm.act("IDLE",
+                If(self.ctl.re | ~enable | (hold_r & ~self.hold),
+                   NextValue(self.boosting.status, 1),
+                   NextValue(integ, 0),
+                   NextValue(sample_count, 0),
+                ).Elif(self.strobe & ~self.hold & ~self.fault.status,
+                   If(sample_count + 1 >= self.interval.storage,
+                      NextValue(sample_count, 0),
+                      NextValue(err, self.target - self.sample),
+                      NextState("GAINS"),
+                   ).Else(
+                      NextValue(sample_count, sample_count + 1),
+                   )
+                )
+        )
+        fsm.act("GAINS",
+                If(self.boosting.status & (self.sample + self.trim_window.storage < self.target),
+                   NextState("ISSUE_BOOST"),
+                ).Else(
+                   NextValue(self.boosting.status, 0),
+                   NextValue(p_term, err * self.kp.storage),
+                   # anti-windup: the integrator only moves while the output isn't pinned at a rail in the same direction
+                   If(~(((err > 0) & (self.code == self.code_max.storage)) | ((err < 0) & (self.code == 0))),
+                      If(integ + err > integ_max,
+                         NextValue(integ, integ_max),
+                      ).Elif(integ + err < -integ_max,
+                         NextValue(integ, -integ_max),
+                      ).Else(
+                         NextValue(integ, integ + err),
+                      )
+                   ),
+                   NextState("INTEGRAL"),
+                )
+        )
+        fsm.act("INTEGRAL",
+                NextValue(i_term, integ * self.ki.storage),
+                NextState("SUM"),
+        )
+        fsm.act("SUM",
+                NextValue(total, (Mux(self.ff_code != 0, self.ff_code, self.feedforward.storage) << 8) + p_term + i_term),
+                NextState("ISSUE_PI"),
+        )
+        fsm.act("ISSUE_BOOST",
+                If(self.dac_ready,
+                   NextValue(self.code, Mux(self.boost.storage > self.code_max.storage, self.code_max.storage, self.boost.storage)),
+                   NextState("SEND"),
+                )
+        )
+        fsm.act("ISSUE_PI",
+                If(self.dac_ready,
+                   If(total < 0,
+                      NextValue(self.code, 0),
+                   ).Elif((total >> 8) > self.code_max.storage,
+                      NextValue(self.code, self.code_max.storage),
+                   ).Else(
+                      NextValue(self.code, total[8:24]),
+                   ),
+                   NextState("SEND"),
+                )
+        )
+        fsm.act("SEND", # code is registered now, so the DAC sees a stable value with the update pulse
+                If(self.active,
+                   self.update.eq(1),
+                ),
+                NextState("IDLE"),
+        )
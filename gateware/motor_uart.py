@@ -0,0 +1,83 @@
+from migen import *
+from migen.genlib.fifo import SyncFIFOBuffered
+
+from litex.soc.interconnect.csr import *
+from litex.soc.interconnect.csr_eventmanager import *
+
+# UART for the IQ motor link: deep FIFOs and a coalesced receive interrupt
+#   phy - RS232PHY (or compatible) with sink/source streams; its tuning_word CSR sets the baud rate at runtime
+#   fifo_depth integer - PARAMETER depth of the TX and RX FIFOs, should hold a full IQ packet (64 bytes) or more
+#   rx_timeout integer - PARAMETER reset value of the rx_timeout CSR, in sysclk cycles
+#   CSR rxtx - read returns the head of the RX FIFO, write pushes into the TX FIFO (same as litex UART)
+#   CSR txfull (ro) - TX FIFO is full (same as litex UART)
+#   CSR rxempty (ro) - RX FIFO is empty (same as litex UART)
+#   CSR txempty (ro) - TX FIFO has drained into the PHY; wait on this before changing the baud rate
+#   CSR rxlevel (ro, 8) - number of bytes waiting in the RX FIFO
+#   CSR rx_threshold (wo, 8) - raise the rx event once this many bytes are waiting
+#   CSR rx_timeout (wo, 24) - raise the rx event when data is waiting and the line has been idle this many sysclk cycles
+#   ev tx - fires when the TX FIFO stops being full (same as litex UART)
+#   ev rx - pulses on threshold or idle timeout, so a whole packet is drained per interrupt. Writing its
+#           pending bit pops one byte from the RX FIFO, so the litex UART ISR idiom keeps working.
+class MotorUART(Module, AutoCSR):
+    def __init__(self, phy, fifo_depth=128, rx_timeout=17361):
+        self._rxtx = CSR(8)
+        self._txfull = CSRStatus()
+        self._rxempty = CSRStatus()
+        self.txempty = CSRStatus()
+        self.rxlevel = CSRStatus(8)
+        self.rx_threshold = CSRStorage(8, reset=16)
+        self.rx_timeout = CSRStorage(24, reset=rx_timeout)
+
+        self.submodules.ev = EventManager()
+        self.ev.tx = EventSourceProcess()
+        self.ev.rx = EventSourcePulse()
+        self.ev.finalize()
+
+        # TX path
+        tx_fifo = SyncFIFOBuffered(8, fifo_depth)
+        self.submodules += tx_fifo
+        self.comb += [
+            tx_fifo.we.eq(self._rxtx.re),
+            tx_fifo.din.eq(self._rxtx.r),
+            self._txfull.status.eq(~tx_fifo.writable),
+            self.txempty.status.eq(~tx_fifo.readable),
+            phy.sink.valid.eq(tx_fifo.readable),
+            phy.sink.data.eq(tx_fifo.dout),
+            tx_fifo.re.eq(phy.sink.ready),
+            self.ev.tx.trigger.eq(~tx_fifo.writable),
+        ]
+
+        # RX path
+        rx_fifo = SyncFIFOBuffered(8, fifo_depth)
+        self.submodules += rx_fifo
+        self.comb += [
+            rx_fifo.we.eq(phy.source.valid),
+            rx_fifo.din.eq(phy.source.data),
+            phy.source.ready.eq(rx_fifo.writable),
+            self._rxempty.status.eq(~rx_fifo.readable),
+            self._rxtx.w.eq(rx_fifo.dout),
+            rx_fifo.re.eq(self.ev.rx.clear),
+            self.rxlevel.status.eq(rx_fifo.level),
+        ]
+
+        # coalesce rx interrupts: once at threshold, or once when the line goes idle with data waiting
+        idle = Signal(24)
+        timed_out = Signal()
+        pushed = Signal()
+        self.comb += pushed.eq(rx_fifo.we & rx_fifo.writable)
+        self.sync += [
+            If(pushed,
+               idle.eq(0),
+               timed_out.eq(0),
+            ).Elif(~rx_fifo.readable,
+               timed_out.eq(0),
+            ).Elif(idle < self.rx_timeout.storage,
+               idle.eq(idle + 1),
+            ).Else(
+               timed_out.eq(1),
+            )
+        ]
+        self.comb += self.ev.rx.trigger.eq(
+            (pushed & (rx_fifo.level == (self.rx_threshold.storage - 1))) |  # this push reaches the threshold
+            (rx_fifo.readable & (idle == self.rx_timeout.storage) & ~timed_out)  # single pulse on going idle
+        )
@@ -0,0 +1,191 @@
+from migen import *
+
+from litex.soc.interconnect.csr import *
+from litex.soc.interconnect import wishbone
+
+# Autonomous plate sequencer: runs a table of per-well entries back to back without the CPU
+#   monitor Zappy_adc - PARAMETER the capture block to drive through its seq_* inputs
+#   zappio Zappio - PARAMETER the GPIO block to drive through its seq_* inputs
+#   entries integer - PARAMETER number of table entries (wells) the table memory holds
+#   CSR count (wo, 8) - number of table entries to run, starting at entry 0
+#   CSR holdoff (wo, 32) - minimum sysclk cycles from the end of one well's capture to the start of the next (cap recharge time)
+#   CSR stop_on_arc (wo, 1) - end the sequence after a well that hit an arc scram (maxdelta or Zappio's slope detector)
+#   CSR go (wo, 1) - writing anything starts the sequence
+#   CSR abort (wo, 1) - writing anything ends the sequence after the current well
+#   CSR busy (ro, 1) - sequence is running; while busy the sequencer owns row/col, maxdelta and the monitor
+#   CSR index (ro, 8) - entry currently running, or number of entries completed once busy drops
+#   CSR fault (ro, 1) - sequence ended early because of a scram other than maxdelta (see Zappio fault)
+#   self.*ready* `Signal()` - INPUT - the next capture waits for this to be high as well as holdoff (the monitor's charge comparator)
+#   self.*hv_code* `Signal(16)` - OUTPUT - HV DAC code of the running entry, 0 if it has none (for the charge controller)
+#
+#   MEMORY block on wishbone, 8 words per entry. Words 0-3 and 6-7 are written by the CPU, words 4-5 by the sequencer.
+#   Entries can be different wells (a plate run) or the same well at different voltages (a multi-pulse protocol,
+#   with contiguous capture regions making one recording):
+#     word 0: [3:0] row mask, [15:4] col mask, [31:16] depth in samples
+#     word 1: [15:0] word address of the capture region in monitor memory, [31:16] maxdelta code (0 disables)
+#     word 2: energy threshold [31:0]
+#     word 3: [7:0] energy threshold [39:32], [8] energy cutoff enable, [31:9] pulse width in sysclk cycles (0 uses Zappio's CSR)
+#     word 4: energy accumulated [31:0]
+#     word 5: [7:0] energy accumulated [39:32], [8] arc scram (maxdelta or slope) hit, [9] energy cutoff hit, [10] pulse width timer hit,
+#             [26:11] samples from the trigger to the arc scram, [31] entry done
+#     word 6: [11:0] charge comparator target code, [23:12] band; 0 uses the monitor's CSR
+#     word 7: [15:0] HV DAC code, sent when the entry is fetched (0 leaves the DAC alone),
+#             [31:16] holdoff in units of 4096 sysclk cycles (0 uses the holdoff CSR)
+class ZapSequencer(Module, AutoCSR):
+    def __init__(self, monitor, zappio, entries=48):
+        self.count = CSRStorage(8)
+        self.holdoff = CSRStorage(32)
+        self.stop_on_arc = CSRStorage(1)
+        self.go = CSRStorage(1)
+        self.abort = CSRStorage(1)
+        self.busy = CSRStatus(1)
+        self.index = CSRStatus(8)
+        self.fault = CSRStatus(1)
+        self.ready = Signal(reset=1)
+        self.hv_code = Signal(16)
+
+        mem = Memory(32, entries * 8)
+        port = mem.get_port(write_capable=True)
+        self.specials += port
+        self.submodules.wb_sram_if = wishbone.SRAM(mem)
+
+        index = Signal(8)
+        word = Signal(4)
+        cfg = [Signal(32) for i in range(8)]  # words 4-5 are results, never read back
+        self.comb += port.adr.eq(Cat(word[:3], index))
+        holdoff = Signal(32)
+        self.comb += If(cfg[7][16:32] != 0,
+                        holdoff.eq(Cat(Replicate(0, 12), cfg[7][16:32])),
+                     ).Else(
+                        holdoff.eq(self.holdoff.storage),
+                     )
+
+        timer = Signal(32)
+        first = Signal()
+        abort_pending = Signal()
+        cutoff_hit = Signal()
+        self.sync += [
+            If(timer != 0xFFFFFFFF,
+               timer.eq(timer + 1),
+            ),
+            If(self.go.re,
+               abort_pending.eq(0),
+            ).Elif(self.abort.re,
+               abort_pending.eq(1),
+            ),
+            If(monitor.seq_energy_reset,
+               cutoff_hit.eq(0),
+            ).Elif(monitor.energy_cutoff,
+               cutoff_hit.eq(1),
+            ),
+        ]
+
+        self.comb += [
+            monitor.seq_active.eq(self.busy.status),
+            monitor.seq_depth.eq(cfg[0][16:32]),
+            monitor.seq_base.eq(cfg[1][0:16]),
+            monitor.seq_threshold.eq(Cat(cfg[2], cfg[3][0:8])),
+            monitor.seq_cutoff_ena.eq(cfg[3][8]),
+            zappio.seq_active.eq(self.busy.status),
+            zappio.seq_row.eq(cfg[0][0:4]),
+            zappio.seq_col.eq(cfg[0][4:16]),
+            zappio.seq_maxdelta.eq(cfg[1][16:32]),
+            zappio.seq_pulse_width.eq(cfg[3][9:32]),
+            zappio.seq_hv_code.eq(cfg[7][0:16]),
+            monitor.seq_charge_target.eq(cfg[6][0:12]),
+            monitor.seq_charge_band.eq(cfg[6][12:24]),
+            self.hv_code.eq(Mux(self.busy.status, cfg[7][0:16], 0)),
+            self.index.status.eq(index),
+        ]
+
+        fsm = FSM(reset_state="IDLE")
+        self.submodules.fsm = fsm
+        fsm.act("IDLE",
+                NextValue(self.busy.status, 0),
+                If(self.go.re & (self.count.storage != 0),
+                   NextValue(index, 0),
+                   NextValue(word, 0),
+                   NextValue(first, 1),
+                   NextValue(self.fault.status, 0),
+                   NextValue(self.busy.status, 1),
+                   NextState("FETCH"),
+                )
+        )
+        fsm.act("FETCH", # read address leads data by a cycle, so word runs one past the last config word
+                NextValue(word, word + 1),
+                Case(word, {
+                    1: NextValue(cfg[0], port.dat_r),
+                    2: NextValue(cfg[1], port.dat_r),
+                    3: NextValue(cfg[2], port.dat_r),
+                    4: NextValue(cfg[3], port.dat_r),
+                    7: NextValue(cfg[6], port.dat_r),
+                    8: NextValue(cfg[7], port.dat_r),
+                    "default": [],
+                }),
+                If(word == 8,
+                   NextState("SETUP"),
+                )
+        )
+        fsm.act("SETUP",
+                If(cfg[7][0:16] != 0,
+                   zappio.seq_hv_update.eq(1), # ready stays low until the comparator sees the new target met
+                ),
+                NextState("HOLDOFF"),
+        )
+        fsm.act("HOLDOFF", # row/col are already presented to Zappio but stay off until the monitor's trigger
+                If(zappio.fault,
+                   NextValue(self.fault.status, 1),
+                   NextState("IDLE"),
+                ).Elif((first | (timer >= holdoff)) & self.ready,
+                   zappio.seq_clear.eq(1),
+                   monitor.seq_energy_reset.eq(1),
+                   monitor.seq_acquire.eq(1),
+                   NextValue(first, 0),
+                   NextState("CAPTURE_START"),
+                )
+        )
+        fsm.act("CAPTURE_START", # done drops the cycle after acquire
+                If(~monitor.done.status,
+                   NextState("CAPTURE"),
+                )
+        )
+        fsm.act("CAPTURE",
+                If(monitor.done.status,
+                   NextValue(timer, 0),
+                   NextValue(word, 4),
+                   NextState("RESULT"),
+                )
+        )
+        fsm.act("RESULT",
+                port.we.eq(1),
+                NextValue(word, word + 1),
+                If(word == 4,
+                   port.dat_w.eq(monitor.energy_accumulator.fields.energy[0:32]),
+                ).Else(
+                   port.dat_w.eq(Cat(monitor.energy_accumulator.fields.energy[32:40], zappio.arc, cutoff_hit,
+                                     zappio.time_cutoff, zappio.arc_sample.status,
+                                     Replicate(0, 4), 1)),
+                   NextState("NEXT"),
+                )
+        )
+        fsm.act("NEXT",
+                zappio.seq_clear.eq(1), # disengage row/col so the cap can recharge; arc was recorded in RESULT
+                NextValue(word, 0),
+                NextValue(index, index + 1),
+                If(zappio.fault,
+                   NextValue(self.fault.status, 1),
+                   NextState("IDLE"),
+                ).Elif((index + 1 == self.count.storage) | (index + 1 == entries) | abort_pending |
+                       (zappio.arc & self.stop_on_arc.storage),
+                   NextState("IDLE"),
+                ).Else(
+                   NextState("FETCH"),
+                )
+        )
+
+        self.bus = wishbone.Interface()
+        decoder_offset = log2_int(entries * 8, need_pow2=False)
+        def slave_filter(a):
+                return a[decoder_offset:32-decoder_offset] == 0  # no aliasing in the block
+        wb_con = wishbone.Decoder(self.bus, [(slave_filter, self.wb_sram_if.bus)], register=True)
+        self.submodules += wb_con
@@ -0,0 +1,20 @@
+from migen import *
+
+from litex.soc.interconnect.csr import *
+
+# 64-bit free-running sysclk cycle counter, the firmware's time base. Never reset after power-on and never
+# reprogrammed, so unlike timer0 it doesn't wrap in practice (5800 years at 100MHz)
+#   CSR latch (wo, 1) - writing anything snapshots the counter into value, so both halves read back consistent
+#   CSR value (ro, 64) - counter at the last latch write
+class SysTime(Module, AutoCSR):
+    def __init__(self):
+        self.latch = CSRStorage(1)
+        self.value = CSRStatus(64)
+
+        count = Signal(64)
+        self.sync += [
+            count.eq(count + 1),
+            If(self.latch.re,
+               self.value.status.eq(count),
+            )
+        ]
@@ -25,12 +25,62 @@ from gateware.dac8560 import Dac8560
 #   CSR maxdelta_reset (wo, 1) - reset maxdelta SCRAM condition
 #   CSR maxdelta_scram (ro, 1) - set if there was a SCRAM condition detected on the last run
 #   self.*delta* `Signal(16)` - INPUT - the delta code computed live during the run
+#   self.*fast* `Signal(12)` - INPUT - the fast-path ADC code, updated with delta
+#   self.*sample_strobe* `Signal()` - INPUT - single-cycle pulse when delta and fast hold a new sample
+#   CSR arc_slope (wo, 16) - scram when delta rises by at least this many codes from one sample to the next; 0 disables.
+#                            Catches the leading edge of an arc long before it reaches the maxdelta level
+#   CSR arc_vslope (wo, 12) - scram when the fast path falls by at least this many codes from one sample to the next; 0 disables
+#   CSR arc_holdoff (wo, 16) - samples after the trigger during which the slope detectors are ignored, to ride out the
+#                              legitimate inrush edge as row/col close. Resets to 4 so the edge is covered even if only
+#                              the slopes get programmed
+#   CSR arc_sample (ro, 16) - samples since the trigger when an arc scram (slope or maxdelta) fired; the capture index is
+#                             this plus presample
+#   CSR pulse_width (wo, 32) - disengage row/col exactly this many sysclk cycles after the trigger engaged them; 0 disables
+#   CSR end_cause (ro, 4) - what ended the current run's pulse first: bit 0 pulse_width timer, bit 1 energy cutoff,
+#                           bit 2 maxdelta scram, bit 3 slope (arc_slope/arc_vslope) scram. All 0 if the pulse is still running or ran until the trigger was cleared.
+#                           Cleared with the trigger (triggerclear, row/col update)
+#   CSR end_cycles (ro, 32) - sysclk cycles row/col were engaged before the pulse ended (or so far, while it runs)
+#   self.*seq_pulse_width* `Signal(23)` - INPUT - pulse_width while seq_active
+#   self.*time_cutoff* `Signal()` - OUTPUT - the pulse_width timer ended the current run's pulse
+#   self.*seq_active* `Signal()` - INPUT - a ZapSequencer owns row/col and maxdelta: seq_* below replace those CSRs
+#   self.*seq_row* `Signal(4)`, self.*seq_col* `Signal(12)` - INPUT - row/col to engage on trigger while seq_active
+#   self.*seq_maxdelta* `Signal(16)` - INPUT - maxdelta scram threshold while seq_active, 0 disables the scram
+#   self.*seq_clear* `Signal()` - INPUT - single-cycle pulse, same effect as writing triggerclear
+#   self.*arc* `Signal()` - OUTPUT - maxdelta or slope scram latched on the current run
+#   self.*fault* `Signal()` - OUTPUT - scram from any source other than maxdelta (external scram, plate missing)
+#   self.*hv_auto* `Signal()` - INPUT - a ChargeController owns the HV DAC: hv_auto_code replaces hv_setting
+#   self.*hv_auto_code* `Signal(16)` - INPUT - DAC code from the charge controller
+#   self.*hv_auto_update* `Signal()` - INPUT - single-cycle pulse, same effect as writing hv_update. When hv_auto drops,
+#                                        hv_setting is re-sent automatically
+#   self.*seq_hv_code* `Signal(16)` - INPUT - per-pulse HV DAC code from a ZapSequencer protocol
+#   self.*seq_hv_update* `Signal()` - INPUT - single-cycle pulse: send seq_hv_code to the DAC as soon as it is free, and
+#                                       keep it in place of hv_setting until seq_active drops (then hv_setting is
+#                                       re-sent). Ignored while hv_auto, since the charge controller owns the DAC
+#   self.*hv_dac_ready* `Signal()` - OUTPUT - the DAC can take another update
+#   self.*engaged* `Signal()` - OUTPUT - row/col trigger is active (the cap is being discharged into a well)
 
 class Zappio(Module, AutoCSR):
     def __init__(self, pads, hvdac_pads):
         self.scram = Signal()  # this is the emergency shutdown signal
         myscram = Signal()
 
+        self.seq_active = Signal()
+        self.seq_row = Signal(4)
+        self.seq_col = Signal(12)
+        self.seq_maxdelta = Signal(16)
+        self.seq_clear = Signal()
+        self.seq_pulse_width = Signal(23)
+        self.time_cutoff = Signal()
+        self.arc = Signal()
+        self.fault = Signal()
+        self.hv_auto = Signal()
+        self.hv_auto_code = Signal(16)
+        self.hv_auto_update = Signal()
+        self.seq_hv_code = Signal(16)
+        self.seq_hv_update = Signal()
+        self.hv_dac_ready = Signal()
+        self.engaged = Signal()
+
         self.trigger = Signal()
         self.triggerctl = CSRStorage(2)
         mytrigger = Signal()
@@ -44,8 +94,13 @@ class Zappio(Module, AutoCSR):
 
         self.override_safety = CSRStorage(1)
         maxdelta_scram = Signal()
+        slope_scram = Signal()
         # noplate should be all 0's if a plate is properly present, do not apply HV if plate is absent
-        self.comb += myscram.eq( (self.scram | (noplate_sync != 0) | maxdelta_scram) & ~self.override_safety.storage)
+        self.comb += myscram.eq( (self.scram | (noplate_sync != 0) | maxdelta_scram | slope_scram) & ~self.override_safety.storage)
+        self.comb += [
+            self.fault.eq( (self.scram | (noplate_sync != 0)) & ~self.override_safety.storage),
+            self.arc.eq(maxdelta_scram | slope_scram),
+        ]
         self.scram_status = CSRStatus(1)
         self.comb += self.scram_status.status.eq(myscram)
 
@@ -77,7 +132,7 @@ class Zappio(Module, AutoCSR):
         self.triggerclear = CSRStorage(1)
         self.triggerstatus = CSRStatus(1)
         self.sync += [
-            If(self.triggerclear.re | self.row.re | self.col.re, # auto-clear if row or col is updated
+            If(self.triggerclear.re | self.row.re | self.col.re | self.seq_clear, # auto-clear if row or col is updated
                triggerlatch.eq(0)
             ).Elif(self.trigger, # this should come from the Zappy_adc module
                triggerlatch.eq(1)
@@ -85,16 +140,61 @@ class Zappio(Module, AutoCSR):
                triggerlatch.eq(triggerlatch)
             )
         ]
+        # pulse-width timer: counts engaged cycles, and the first thing that ends the pulse is latched as its cause
+        self.pulse_width = CSRStorage(32)
+        self.end_cause = CSRStatus(fields=[
+            CSRField("time", size=1, description="pulse_width timer expired"),
+            CSRField("energy", size=1, description="energy cutoff reached"),
+            CSRField("arc", size=1, description="maxdelta scram"),
+            CSRField("slope", size=1, description="arc slope scram"),
+        ])
+        self.end_cycles = CSRStatus(32)
+        width = Signal(32)
+        width_expired = Signal()
+        ended = Signal()
+        causes = [self.end_cause.fields.time, self.end_cause.fields.energy, self.end_cause.fields.arc,
+                  self.end_cause.fields.slope]  # status is driven from these, so they're the only thing to assign
+        self.comb += [
+            width.eq(Mux(self.seq_active, self.seq_pulse_width, self.pulse_width.storage)),
+            ended.eq(Cat(*causes) != 0),
+            self.time_cutoff.eq(self.end_cause.fields.time),
+        ]
+        self.sync += [
+            If(self.triggerclear.re | self.row.re | self.col.re | self.seq_clear,
+               width_expired.eq(0),
+               [c.eq(0) for c in causes],
+               self.end_cycles.status.eq(0),
+            ).Elif(mytrigger & ~ended,
+               If(slope_scram,
+                  self.end_cause.fields.slope.eq(1),
+               ).Elif(maxdelta_scram,
+                  self.end_cause.fields.arc.eq(1),
+               ).Elif(self.energy_cutoff,
+                  self.end_cause.fields.energy.eq(1),
+               ).Else(
+                  self.end_cycles.status.eq(self.end_cycles.status + 1),
+                  If((width != 0) & ((self.end_cycles.status + 1) >= width), # row/col drop after exactly width cycles
+                     width_expired.eq(1),
+                     self.end_cause.fields.time.eq(1),
+                  )
+               )
+            )
+        ]
+
         self.comb += [
             mytrigger.eq( (triggerlatch & ~self.triggermode.storage) | (self.triggersoft.storage & self.triggermode.storage) ),
-            If( (myscram | ~mytrigger | self.energy_cutoff),
+            If( (myscram | ~mytrigger | self.energy_cutoff | width_expired),
                row_gpio.eq(0),
                col_gpio.eq(0),
+            ).Elif(self.seq_active,
+                row_gpio.eq(self.seq_row),
+                col_gpio.eq(self.seq_col),
             ).Else(
                 row_gpio.eq(self.row.storage),
                 col_gpio.eq(self.col.storage),
             ),
-            self.triggerstatus.status.eq(mytrigger)
+            self.triggerstatus.status.eq(mytrigger),
+            self.engaged.eq(mytrigger & ~width_expired),
         ]
 
         self.maxdelta = CSRStorage(16)
@@ -102,12 +202,18 @@ class Zappio(Module, AutoCSR):
         self.maxdelta_reset = CSRStorage(1)  # probably not really needed because triggerclear also resets maxdelta scram
         self.maxdelta_scram = CSRStatus(1)
         self.delta = Signal(16)
-        self.comb += self.maxdelta_scram.status.eq(maxdelta_scram)
+        maxdelta_trip = Signal()
+        self.comb += [
+            self.maxdelta_scram.status.eq(maxdelta_scram),
+            maxdelta_trip.eq(mytrigger & Mux(self.seq_active,
+                                             (self.delta >= self.seq_maxdelta) & (self.seq_maxdelta != 0),
+                                             (self.delta >= self.maxdelta.storage) & self.maxdelta_ena.storage[0])), # only consider delta during trigger
+        ]
         self.sync += [
-            If(self.maxdelta_reset.re | self.triggerclear.re,
+            If(self.maxdelta_reset.re | self.triggerclear.re | self.seq_clear,
                maxdelta_scram.eq(0)
             ).Else(
-               If( mytrigger & (self.delta >= self.maxdelta.storage) & self.maxdelta_ena.storage, # only consider delta during trigger
+               If( maxdelta_trip,
                    maxdelta_scram.eq(1),
                ).Else(
                    maxdelta_scram.eq(maxdelta_scram)
@@ -115,6 +221,47 @@ class Zappio(Module, AutoCSR):
             )
         ]
 
+        # arc predictor: sample-to-sample slope of delta (current up) and of the fast path (voltage down) during the
+        # trigger. Applies to sequenced runs too
+        self.fast = Signal(12)
+        self.sample_strobe = Signal()
+        self.arc_slope = CSRStorage(16)
+        self.arc_vslope = CSRStorage(12)
+        self.arc_holdoff = CSRStorage(16, reset=4)
+        self.arc_sample = CSRStatus(16)
+        prev_delta = Signal(16)
+        prev_fast = Signal(12)
+        samples = Signal(16)  # samples since the trigger, saturating
+        slope_trip = Signal()
+        self.comb += slope_trip.eq(mytrigger & self.sample_strobe & (samples >= self.arc_holdoff.storage) & (
+            ((self.arc_slope.storage != 0) & (self.delta > prev_delta) &
+             ((self.delta - prev_delta) >= self.arc_slope.storage)) |
+            ((self.arc_vslope.storage != 0) & (prev_fast > self.fast) &
+             ((prev_fast - self.fast) >= self.arc_vslope.storage))
+        ))
+        self.sync += [
+            If(self.sample_strobe,
+               prev_delta.eq(self.delta),
+               prev_fast.eq(self.fast),
+            ),
+            If(~mytrigger,
+               samples.eq(0),
+            ).Elif(self.sample_strobe & (samples != 0xFFFF),
+               samples.eq(samples + 1),
+            ),
+            If(self.maxdelta_reset.re | self.triggerclear.re | self.seq_clear,
+               slope_scram.eq(0),
+               self.arc_sample.status.eq(0),
+            ).Else(
+               If(slope_trip,
+                  slope_scram.eq(1),
+               ),
+               If((slope_trip | maxdelta_trip) & ~maxdelta_scram & ~slope_scram, # first arc of the run
+                  self.arc_sample.status.eq(samples),
+               )
+            )
+        ]
+
         # report if the HV motherboard has been unplugged and we are somehow operating in either a debug mode or a really bad error mode
         self.mb_unplugged = CSRStatus(1)
         mb_unplugged_gpio = getattr(pads, "mb_unplugged")
@@ -154,11 +301,30 @@ class Zappio(Module, AutoCSR):
 
         self.specials += MultiReg(self.hvdac.ready, self.hv_ready.status)
         # no synchronizer for the data because we assume it doesn't move while "update" is being written
+        seq_hv = Signal()  # a sequencer code is in place of hv_setting
+        seq_hv_code = Signal(16)
+        seq_hv_pending = Signal()
         self.comb += If(myscram,
                         self.hvdac.data.eq(0),  # in case of scram condition, set HVDAC data to 0
+                    ).Elif(self.hv_auto,
+                        self.hvdac.data.eq(self.hv_auto_code)
+                    ).Elif(seq_hv,
+                        self.hvdac.data.eq(seq_hv_code)
                     ).Else(
                         self.hvdac.data.eq(self.hv_setting.storage)
                     )
+        hv_auto_r = Signal()
+        seq_hv_r = Signal()
+        self.sync += [
+            hv_auto_r.eq(self.hv_auto),
+            seq_hv_r.eq(seq_hv),
+            If(~self.seq_active,
+               seq_hv.eq(0),
+            ).Elif(self.seq_hv_update & ~self.hv_auto,
+               seq_hv.eq(1),
+               seq_hv_code.eq(self.seq_hv_code),
+            ),
+        ]
 
         # extend CSR update single-cycle pulse to several cycles so DAC is sure to see it (running in a slower domain)
         trigger = Signal()
@@ -168,13 +334,22 @@ class Zappio(Module, AutoCSR):
         self.submodules += fsm
         fsm.act("IDLE",
                 NextValue(count, 0),
-                If(self.hv_update.re | myscram, # in case of scram, repeatedly force the DAC output to 0
+                If(self.hv_update.re | myscram | (self.hv_auto & self.hv_auto_update) | (hv_auto_r & ~self.hv_auto) | # in case of scram, repeatedly force the DAC output to 0
+                   seq_hv_pending | (seq_hv_r & ~seq_hv),
                    NextState("TRIGGER"),
                    NextValue(trigger, 1),
                 ).Else(
                    NextValue(trigger, 0),
                 )
         )
+        self.comb += self.hv_dac_ready.eq(fsm.ongoing("IDLE") & self.hv_ready.status)
+        self.sync += [
+            If(self.seq_hv_update & self.seq_active & ~self.hv_auto, # same edge seq_hv_code latches, so IDLE sees the new code
+               seq_hv_pending.eq(1),
+            ).Elif(fsm.ongoing("IDLE") | ~self.seq_active | self.hv_auto, # IDLE sends it on the cycle it sees it
+               seq_hv_pending.eq(0),
+            ),
+        ]
         fsm.act("TRIGGER",
                 NextValue(count, count + 1),
                 If(count >= 15,  # assert acquire pulse long enough so DAC block (at 5x-15x slower clock) is sure to get it
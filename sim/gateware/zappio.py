@@ -0,0 +1 @@
+../../gateware/zappio.py
\ No newline at end of file
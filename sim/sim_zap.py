@@ -0,0 +1,299 @@
+#!/usr/bin/env python3
+
+import lxbuildenv_sim
+
+# Pure migen simulation, no vendor tools: the only things the simulator can't run are the ODDR2 sclk mirrors, and
+# they're dropped (see sim_fragment)
+LX_DEPENDENCIES = []
+
+import argparse
+import random
+import sys
+import time
+
+from migen import *
+from migen.sim import run_simulation, passive
+
+from gateware.adc121s101 import Zappy_adc
+from gateware.zappio import Zappio
+
+# Testbench and benchmark for the whole zap path, Zappy_adc + Zappio wired up as in zappy.py, with behavioural
+# ADC121S101s sampling a simulated storage cap discharging into a well whenever row/col are engaged. Reports the
+# achieved sample period, overrun, energy accumulator against a software reference of the samples it was fed,
+# end-to-end trigger latency, and (second run) energy cutoff latency. Runs in seconds on a plain Linux box:
+#   python3 sim_zap.py
+#   python3 sim_zap.py --period 2 --depth 400 --cap-uf 10
+
+SYS_PERIOD = 10  # ns, 100MHz
+ADC_PERIOD = 50  # ns, 20MHz
+VOLTS_PER_CODE = 0.281  # roughly the production calibration of both paths
+
+
+# Behavioural ADC121S101: tracks value while cs_n is high, holds it when cs_n falls, then shifts out 3 leading zeros
+# and the 12 bits MSB first, one per sclk (the "adc" clock, as Adc121s101Stream mirrors it)
+#   pads Record - "cs_n" (input), "dout" (output)
+#   self.*value* `Signal(12)` - INPUT - code the analog input currently corresponds to
+class Adc121s101Model(Module):
+    def __init__(self, pads):
+        self.value = Signal(12)
+
+        n = Signal(5)  # cycles since cs_n fell
+        shift = Signal(12)
+        self.sync.adc += [
+            If(pads.cs_n,
+               n.eq(0),
+               shift.eq(self.value),
+            ).Else(
+               If(n != 31,
+                  n.eq(n + 1),
+               ),
+               If(n >= 3,
+                  shift.eq(Cat(0, shift[:11])),
+               )
+            )
+        ]
+        self.comb += pads.dout.eq((n >= 3) & shift[11])
+
+
+adc_layout = [("cs_n", 1), ("dout", 1), ("sclk", 1)]
+zappio_layout = [("noplate", 4), ("row", 4), ("col", 12), ("hv_engage", 1), ("cap", 1), ("discharge", 1),
+                 ("mb_unplugged", 1), ("mk_unplugged", 1), ("l25_pos", 1), ("l25_open", 1)]
+hvdac_layout = [("sync", 1), ("din", 1), ("sclk", 1)]
+
+
+class ZapBench(Module):
+    def __init__(self, memdepth):
+        self.clock_domains.cd_adc = ClockDomain()
+
+        self.adc_pads = Record(adc_layout)
+        self.fadc_pads = Record(adc_layout)
+        self.zappio_pads = Record(zappio_layout)  # noplate etc. read 0: plate present, no scram
+        self.submodules.slow_adc = Adc121s101Model(self.adc_pads)
+        self.submodules.fast_adc = Adc121s101Model(self.fadc_pads)
+
+        self.submodules.monitor = Zappy_adc(self.adc_pads, self.fadc_pads, memdepth=memdepth)
+        self.submodules.zappio = Zappio(self.zappio_pads, Record(hvdac_layout))
+        self.comb += [
+            self.zappio.trigger.eq(self.monitor.ext_trigger),
+            self.zappio.energy_cutoff.eq(self.monitor.energy_cutoff),
+            self.zappio.delta.eq(self.monitor.livedelta),
+            self.zappio.fast.eq(self.monitor.fast_sample),
+            self.zappio.sample_strobe.eq(self.monitor.slow_strobe),
+        ]
+
+
+def sim_fragment(bench):
+    # the ODDR2 sclk mirrors are vendor primitives the simulator can't lower, and nothing here looks at sclk
+    frag = bench.get_fragment()
+    frag.specials = {s for s in frag.specials if not isinstance(s, Instance)}
+    return frag
+
+
+# The storage cap discharging through the series sense resistor into the well while row/col are engaged. The slow
+# path sees the cap, the fast path sees HV main (the well side of the sense resistor), which bleeds to 0 between pulses
+class Plant:
+    def __init__(self, args):
+        self.v = args.v0
+        self.rsense = args.rsense
+        self.rwell = args.rwell
+        self.cap = args.cap_uf * 1e-6
+        self.noise = args.noise
+        self.rng = random.Random(args.seed)
+        self.engaged = False
+        self.joules = 0.0
+
+    def step(self, dt, engaged):
+        self.engaged = engaged
+        if engaged:
+            i = self.v / (self.rsense + self.rwell)
+            self.joules += i * i * self.rwell * dt
+            self.v -= i * dt / self.cap
+
+    def code(self, volts):
+        c = int(round(volts / VOLTS_PER_CODE + self.rng.gauss(0, self.noise)))
+        return min(max(c, 0), 0xFFF)
+
+    def sample(self):
+        main = self.v * self.rwell / (self.rsense + self.rwell) if self.engaged else 0.0
+        return self.code(self.v), self.code(main)
+
+
+class Report:
+    def __init__(self):
+        self.log = []  # (hold time ns, slow, fast) per conversion, in stream order
+        self.mismatches = 0
+        self.periods = []
+        self.energy_ref = 0
+        self.trigger_t = None
+        self.trigger_sample_t = None
+        self.engage_t = None
+        self.release_t = None
+        self.cross_t = None
+        self.energy = None
+        self.overrun = None
+        self.end_cause = None
+
+
+@passive
+def adc_model(bench, plant, r):
+    t = 0
+    cs_prev = 0
+    while True:
+        row = yield bench.zappio_pads.row
+        col = yield bench.zappio_pads.col
+        plant.step(ADC_PERIOD * 1e-9, row != 0 and col != 0)
+        cs = yield bench.adc_pads.cs_n
+        if cs and not cs_prev:
+            # start of the quiet time: the next conversion holds this value when cs_n falls 4 cycles from now
+            slow, fast = plant.sample()
+            r.log.append((t + 4 * ADC_PERIOD, slow, fast))
+            yield bench.slow_adc.value.eq(slow)
+            yield bench.fast_adc.value.eq(fast)
+        cs_prev = cs
+        t += ADC_PERIOD
+        yield
+
+
+@passive
+def watcher(bench, r, threshold):
+    m = bench.monitor
+    t = 0
+    nstream = 0
+    last_strobe = None
+    while True:
+        if (yield m.stream.strobe):
+            if nstream > 0:  # the first frame after reset has no cs_n falling edge, so it carries no sample
+                _, slow, fast = r.log[nstream - 1]
+                if (yield m.stream.adc_data) != slow or (yield m.stream.fadc_data) != fast:
+                    r.mismatches += 1
+            nstream += 1
+        if (yield m.slow_strobe):
+            if last_strobe is not None:
+                r.periods.append(t - last_strobe)
+            last_strobe = t
+        if (yield m.metrics.strobe):  # the energy accumulator's window, trigger sample onward
+            slow = yield m.metrics.slow
+            fast = yield m.metrics.fast
+            if r.trigger_t is None:
+                r.trigger_t = t
+                r.trigger_sample_t = r.log[nstream - 2][0]  # the latest stream sample is the one in hand
+            if slow > fast:
+                r.energy_ref += (slow - fast) * fast
+            if threshold and r.cross_t is None and r.energy_ref > threshold:
+                r.cross_t = t
+        row = yield bench.zappio_pads.row
+        if row and r.engage_t is None:
+            r.engage_t = t
+        if not row and r.engage_t is not None and r.release_t is None:
+            r.release_t = t
+        t += SYS_PERIOD
+        yield
+
+
+def capture(bench, args, r, threshold):
+    m = bench.monitor
+    z = bench.zappio
+    # CSRs are driven directly: no CSR bank here, so field CSRs are driven and read through their fields
+    yield m.period.storage.eq(args.period)
+    yield m.depth.storage.eq(args.depth)
+    yield m.presample.storage.eq(args.presample)
+    yield z.row.storage.eq(1)
+    yield z.col.storage.eq(1)
+    if threshold:
+        yield m.energy_threshold.fields.threshold.eq(threshold)
+        yield m.energy_control.fields.enable.eq(1)
+    for i in range(20 * args.period * 100):  # let the stream and the decimator settle for 20 samples
+        yield
+
+    yield m.acquire.re.eq(1)
+    yield
+    yield m.acquire.re.eq(0)
+    yield
+    while not (yield m.done.status):
+        yield
+    r.energy = yield m.energy_accumulator.fields.energy
+    r.overrun = yield m.overrun.status
+    r.end_cause = {}
+    for f in ["time", "energy", "arc", "slope"]:
+        r.end_cause[f] = yield getattr(z.end_cause.fields, f)
+
+
+def run(args, threshold=0, vcd=None):
+    bench = ZapBench(args.memdepth)
+    plant = Plant(args)
+    r = Report()
+    run_simulation(sim_fragment(bench), {
+        "sys": [capture(bench, args, r, threshold), watcher(bench, r, threshold)],
+        "adc": adc_model(bench, plant, r),
+    }, clocks={"sys": SYS_PERIOD, "adc": ADC_PERIOD}, vcd_name=vcd)
+    return r, plant
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Zappy_adc + Zappio testbench and benchmark")
+    parser.add_argument("--period", type=int, default=1, help="monitor decimation (samples of the 1 MSPS stream)")
+    parser.add_argument("--depth", type=int, default=300, help="capture depth in samples")
+    parser.add_argument("--presample", type=int, default=16, help="samples before the trigger")
+    parser.add_argument("--memdepth", type=int, default=1024, help="capture memory words")
+    parser.add_argument("--v0", type=float, default=500.0, help="storage cap starting voltage")
+    parser.add_argument("--cap-uf", type=float, default=4.7, help="storage cap in uF")
+    parser.add_argument("--rwell", type=float, default=20.0, help="well resistance in ohms")
+    parser.add_argument("--rsense", type=float, default=1.0, help="series sense resistance in ohms")
+    parser.add_argument("--noise", type=float, default=1.0, help="ADC noise, codes rms")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--vcd", default=None, help="also dump a VCD of the first run to this file")
+    args = parser.parse_args()
+    assert args.depth < args.memdepth and args.presample < args.depth
+
+    failures = 0
+    start = time.time()
+    r, plant = run(args, vcd=args.vcd)
+    wall = time.time() - start
+
+    periods = r.periods
+    mean = sum(periods) / len(periods)
+    print("sample period: mean {:.3f} us, min {:.3f} us, max {:.3f} us over {} samples (expected {} us)".format(
+        mean / 1000, min(periods) / 1000, max(periods) / 1000, len(periods), args.period))
+    if abs(mean - args.period * 1000) > SYS_PERIOD:
+        print("FAIL: sample period")
+        failures += 1
+
+    print("stream: {} conversions, {} mismatched against the ADC models, overrun {}".format(
+        len(r.log), r.mismatches, r.overrun))
+    if r.mismatches or r.overrun:
+        print("FAIL: stream")
+        failures += 1
+
+    print("energy: accumulator {}, reference {} from the accumulated samples ({:.3f} J delivered to the well)".format(
+        r.energy, r.energy_ref, plant.joules))
+    if r.energy != r.energy_ref:
+        print("FAIL: energy accumulator")
+        failures += 1
+
+    if r.trigger_t is None or r.engage_t is None:
+        print("FAIL: never triggered")
+        failures += 1
+    else:
+        print("trigger latency: {:.3f} us from the trigger sample's hold to ext_trigger, +{} ns to row/col".format(
+            (r.trigger_t - r.trigger_sample_t) / 1000, r.engage_t - r.trigger_t))
+    print("simulated {:.1f} us in {:.1f} s".format(r.log[-1][0] / 1000, wall))
+
+    # second run: cut off at half the energy the first one accumulated
+    if r.energy:
+        threshold = r.energy // 2
+        rc, _ = run(args, threshold)
+        if rc.cross_t is None or rc.release_t is None or not rc.end_cause["energy"]:
+            print("FAIL: energy cutoff at {} didn't end the pulse (end_cause {})".format(threshold, rc.end_cause))
+            failures += 1
+        else:
+            print("energy cutoff: row/col released {} ns after the accumulator passed {}, pulse {:.3f} us".format(
+                rc.release_t - rc.cross_t, threshold, (rc.release_t - rc.engage_t) / 1000))
+
+    if failures:
+        print("FAIL")
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,121 @@
+// Host-side check of the integer calibration path (firmware/calibration.c) against the original soft-float
+// routines from ui.c. Built once per calibration record by test/Makefile:
+//   make -C test cal
+// Every ADC code, and every millivolt from 0 to 1000V, has to land within 1 LSB of the float result.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "zappy-calibration.h"
+
+const cal_record zappy_cal = {HOSTNAME, FAST_M, FAST_B, SLOW_M, SLOW_B, P5V_ADC, P5V_ADC_LOGIC, FS_DAC, HVDAC_M, HVDAC_B, CAPRES, ENERGY_COEFF, ONEJOULE};
+
+// the float routines as they were in ui.c, kept verbatim as the reference
+uint16_t volts_to_hvdac_code(float voltage) {
+  return (uint16_t) ( (voltage * zappy_cal.fs_dac / 1000.0 ) * zappy_cal.hvdac_m + zappy_cal.hvdac_b);
+}
+
+float mk_code_to_voltage(uint16_t code) {
+  float lsb = zappy_cal.p5v_adc_logic / 4096.0;
+
+  float voltage = ((float)code) * lsb - (zappy_cal.p5v_adc_logic / 8192.0);
+
+  return voltage * 200.0;  // 0-5V ADC corresponds to 0-1000V on supply
+}
+
+float convert_code(uint16_t code, uint8_t adc_path) {
+  float lsb = zappy_cal.p5v_adc / 4096.0;
+
+  float voltage = ((float)code) * lsb - (zappy_cal.p5v_adc / 8192.0);
+  // subtract 0.5LSB as the 0->1 transition occurs at 0.5LSB, not 1.0LSB
+
+  if( voltage < 0.0 )
+    voltage = 0.0;
+
+  float hv = 0.0;
+  if( adc_path == ADC_SLOW ) {
+    hv = voltage * zappy_cal.slow_m + zappy_cal.slow_b;
+  } else {
+    hv = voltage * zappy_cal.fast_m + zappy_cal.fast_b;
+  }
+
+  if( hv < 0.0 )
+    hv = 0.0;
+
+  return hv;
+}
+
+uint16_t convert_voltage_adc_code(float hv, uint8_t adc_path) {
+  float voltage = 0.0;
+  if( adc_path == ADC_SLOW ) {
+    voltage = (hv - zappy_cal.slow_b) / zappy_cal.slow_m;
+  } else {
+    voltage = (hv - zappy_cal.fast_b) / zappy_cal.fast_m;
+  }
+
+  float lsb = zappy_cal.p5v_adc / 4096.0;
+  uint16_t code = (uint16_t) ((voltage + (zappy_cal.p5v_adc / 8192.0)) / lsb); // slightly wrong as it rounds up
+
+  return code;
+}
+
+static int errors = 0;
+
+static void check(const char *what, uint32_t in, double got, double ref, double tol, double *worst) {
+  double err = fabs(got - ref);
+
+  if( err > *worst )
+    *worst = err;
+  if( err > tol && errors++ < 10 )
+    printf( "%s(%u) = %.0f, expected %.3f\n", what, in, got, ref );
+}
+
+int main(void) {
+  const char *path_name[2] = {"slow", "fast"};
+  float m[2] = {SLOW_M, FAST_M};
+  double worst, lsb_mv;
+  uint32_t code, mv;
+  int path;
+
+  cal_init();
+
+  for( path = ADC_SLOW; path <= ADC_FAST; path++ ) {
+    lsb_mv = P5V_ADC / 4096.0 * m[path] * 1000.0;
+
+    worst = 0.0;
+    for( code = 0; code < 4096; code++ )
+      check( "adc_code_to_mv", code, adc_code_to_mv(code, path), convert_code(code, path) * 1000.0, lsb_mv, &worst );
+    printf( "%s: adc_code_to_mv worst error %.1f mV (1 LSB = %.1f mV)\n", path_name[path], worst, lsb_mv );
+
+    worst = 0.0;
+    for( mv = 0; mv <= 1000000; mv++ )
+      check( "mv_to_adc_code", mv, mv_to_adc_code(mv, path), convert_voltage_adc_code(mv / 1000.0f, path), 1.0, &worst );
+    printf( "%s: mv_to_adc_code worst error %.0f LSB\n", path_name[path], worst );
+  }
+
+  lsb_mv = P5V_ADC_LOGIC / 4096.0 * 200.0 * 1000.0;
+  worst = 0.0;
+  for( code = 0; code < 4096; code++ )
+    check( "mk_code_to_mv", code, mk_code_to_mv(code), mk_code_to_voltage(code) * 1000.0, lsb_mv, &worst );
+  printf( "mk: mk_code_to_mv worst error %.1f mV (1 LSB = %.1f mV)\n", worst, lsb_mv );
+
+  worst = 0.0;
+  for( mv = 0; mv <= 1000000; mv++ ) {
+    float dac = (mv / 1000.0f * zappy_cal.fs_dac / 1000.0 ) * zappy_cal.hvdac_m + zappy_cal.hvdac_b;
+    if( dac < 0.0 || dac >= 65536.0 )
+      continue; // the float cast is undefined out here; the integer path clamps
+    check( "mv_to_hvdac_code", mv, mv_to_hvdac_code(mv), volts_to_hvdac_code(mv / 1000.0f), 1.0, &worst );
+  }
+  printf( "hvdac: mv_to_hvdac_code worst error %.0f LSB\n", worst );
+
+  worst = 0.0;
+  for( code = 0; code <= 100000; code++ )
+    check( "ma_to_mv", code, ma_to_mv(code), code * zappy_cal.capres, 1.0 + code * zappy_cal.capres * 1e-6, &worst );
+  printf( "capres: ma_to_mv worst error %.1f mV\n", worst );
+
+  check( "energy_lsb_per_mj", 1, energy_lsb_per_mj(), (uint64_t) (zappy_cal.onejoule / 1000.0), 0.0, &worst );
+
+  printf( "%s %s\n", HOSTNAME, errors ? "FAIL" : "PASS" );
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+// Host-side check of the IQ packet CRC (firmware/iq/crc_helper.c) against the original shift/xor routine,
+// plus a rough throughput comparison. Built once per CRC_TABLE setting by test/Makefile:
+//   make -C test crc
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "crc_helper.h"
+
+#define PACKET_LEN 64     // largest IQ packet
+#define NUM_PACKETS 4096
+#define BENCH_ROUNDS 200
+
+// the routine as shipped by IQ, kept verbatim as the reference
+static uint16_t ref_byte(uint16_t crc, uint8_t data) {
+  uint16_t x = (crc >> 8) ^ data;
+  x ^= x >> 4;
+
+  crc = (crc << 8) ^ (x << 12) ^ (x <<5) ^ x;
+  return crc;
+}
+
+static uint16_t ref_make(const uint8_t *data, uint16_t count) {
+  uint16_t crc = 0xffff;
+  uint16_t i;
+  for(i = 0; i < count; i++)
+    crc = ref_byte(crc, data[i]);
+  return crc;
+}
+
+static uint8_t packets[NUM_PACKETS][PACKET_LEN];
+
+int main(void) {
+  int i, j, len, errors = 0;
+  uint16_t crc, ref;
+  unsigned c;
+  clock_t start;
+  double t_ref, t_new;
+  volatile uint16_t sink = 0;
+
+  srand(1);
+  for( i = 0; i < NUM_PACKETS; i++ )
+    for( j = 0; j < PACKET_LEN; j++ )
+      packets[i][j] = rand() & 0xff;
+
+  // every crc state with every data byte
+  for( c = 0; c < 0x10000; c++ ) {
+    for( j = 0; j < 256; j++ ) {
+      if( ByteUpdateCrc(c, j) != ref_byte(c, j) ) {
+        if( errors++ < 10 )
+          printf( "ByteUpdateCrc(0x%04x, 0x%02x) = 0x%04x, expected 0x%04x\n", c, j, ByteUpdateCrc(c, j), ref_byte(c, j) );
+      }
+    }
+  }
+
+  // whole packets, every length, and split accumulation the way client_communication.c does it
+  for( i = 0; i < NUM_PACKETS; i++ ) {
+    len = i % (PACKET_LEN + 1);
+    ref = ref_make(packets[i], len);
+    if( MakeCrc(packets[i], len) != ref ) {
+      if( errors++ < 10 )
+        printf( "MakeCrc packet %d len %d mismatch\n", i, len );
+    }
+    if( len >= 2 ) {
+      crc = ArrayUpdateCrc(MakeCrc(packets[i], 2), &packets[i][2], len - 2);
+      if( crc != ref ) {
+        if( errors++ < 10 )
+          printf( "ArrayUpdateCrc packet %d len %d mismatch\n", i, len );
+      }
+    }
+  }
+
+  start = clock();
+  for( j = 0; j < BENCH_ROUNDS; j++ )
+    for( i = 0; i < NUM_PACKETS; i++ )
+      sink ^= ref_make(packets[i], PACKET_LEN);
+  t_ref = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for( j = 0; j < BENCH_ROUNDS; j++ )
+    for( i = 0; i < NUM_PACKETS; i++ )
+      sink ^= MakeCrc(packets[i], PACKET_LEN);
+  t_new = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+  printf( "CRC_TABLE=%d: reference %.1f MB/s, crc_helper %.1f MB/s (%.2fx)\n", CRC_TABLE,
+	  (double) BENCH_ROUNDS * NUM_PACKETS * PACKET_LEN / t_ref / 1e6,
+	  (double) BENCH_ROUNDS * NUM_PACKETS * PACKET_LEN / t_new / 1e6,
+	  t_ref / t_new );
+
+  if( errors ) {
+    printf( "%d mismatches: FAIL\n", errors );
+    return 1;
+  }
+  printf( "all CRCs match: PASS\n" );
+  return 0;
+}
@@ -0,0 +1 @@
+unsigned int crc32(const unsigned char *buffer, unsigned int len);
@@ -0,0 +1,26 @@
+// Host stand-in for the LiteX-generated csr.h, just enough of it for firmware/libnet and systime.c. The
+// accessors are implemented by the simulated MAC in test/net_bench.c
+#ifndef __GENERATED_CSR_H
+#define __GENERATED_CSR_H
+
+#include <stdint.h>
+
+#define CONFIG_CLOCK_FREQUENCY 100000000
+
+#define CSR_ETHMAC_BASE 0
+#define CSR_ETHMAC_PREAMBLE_CRC_ADDR 0  // the SoC's MAC inserts and checks preamble and CRC itself
+
+unsigned char ethmac_sram_reader_ready_read(void);
+void ethmac_sram_reader_slot_write(unsigned char value);
+void ethmac_sram_reader_length_write(uint16_t value);
+void ethmac_sram_reader_start_write(unsigned char value);
+void ethmac_sram_reader_ev_pending_write(unsigned char value);
+unsigned char ethmac_sram_writer_ev_pending_read(void);
+void ethmac_sram_writer_ev_pending_write(unsigned char value);
+unsigned char ethmac_sram_writer_slot_read(void);
+uint32_t ethmac_sram_writer_length_read(void);
+
+void systime_latch_write(uint32_t value);
+uint64_t systime_value_read(void);
+
+#endif
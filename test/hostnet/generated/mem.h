@@ -0,0 +1,8 @@
+// Host stand-in for the LiteX-generated mem.h: the ethmac slots live in an ordinary array
+#ifndef __GENERATED_MEM_H
+#define __GENERATED_MEM_H
+
+extern unsigned char ethmac_sim_mem[];
+#define ETHMAC_BASE ((unsigned long) ethmac_sim_mem)
+
+#endif
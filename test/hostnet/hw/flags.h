@@ -0,0 +1,11 @@
+#ifndef __HW_FLAGS_H
+#define __HW_FLAGS_H
+
+#define ETHMAC_EV_SRAM_WRITER	0x1
+#define ETHMAC_EV_SRAM_READER	0x1
+
+#define ETHMAC_SLOT_SIZE	2048
+#define ETHMAC_RX_SLOTS		2
+#define ETHMAC_TX_SLOTS		2
+
+#endif
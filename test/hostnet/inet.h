@@ -0,0 +1,13 @@
+// libbase's inet.h for a little-endian host; arpa/inet.h would drag in netinet/in.h, whose IP_TTL clashes with
+// microudp.c's
+#ifndef __INET_H
+#define __INET_H
+
+#include <stdint.h>
+
+static inline uint16_t htons(uint16_t n) { return __builtin_bswap16(n); }
+static inline uint16_t ntohs(uint16_t n) { return __builtin_bswap16(n); }
+static inline uint32_t htonl(uint32_t n) { return __builtin_bswap32(n); }
+static inline uint32_t ntohl(uint32_t n) { return __builtin_bswap32(n); }
+
+#endif
@@ -0,0 +1 @@
+#include "../../../firmware/libnet/microudp.h"
@@ -0,0 +1,3 @@
+// microudp.c calls memcpy without including string.h, leaning on the target compiler's builtin; the host needs
+// the declaration. Nothing else from libbase's system.h is used.
+#include <string.h>
@@ -0,0 +1,590 @@
+// Host-native build of the firmware's network stack (firmware/libnet microudp.c + tftp.c, compiled unmodified)
+// against a simulated ETHMAC, for benchmarking tftp_put() without a board. The MAC's SRAM slots and CSRs are
+// emulated here; frames go over a simulated wire with configurable loss and round-trip time to an in-process peer
+// that answers ARP and acts as a TFTP server. Every upload is compared byte for byte at the peer and every frame's
+// IP and UDP checksums are verified, so this doubles as a test of the stack:
+//   make -C test net
+//   ./test/net_bench -s 65536 -n 20 -r 200 -l 1
+// With -g it benchmarks tftp_get() instead, the netboot path: the peer serves the file with the blksize and
+// windowsize options (RFC 2348, 7440), or as a plain RFC 1350 server with -o, and every download is compared
+// against the source:
+//   ./test/net_bench -g -s 102400 -n 10 -r 200
+// tftp.c times out by counting microudp_service() calls rather than by the clock, so the cost of a lost frame here
+// is whatever 12M host polls take, not what it is on the board; compare retransmit counts across runs, not the
+// absolute penalty.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <generated/csr.h>
+#include <generated/mem.h>
+#include <hw/flags.h>
+
+#include "microudp.h"
+#include "tftp.h"
+#include "../firmware/trace.h"
+
+#define WIRE_DEPTH 64
+
+#define TFTP_SERVER_PORT 69
+#define TFTP_RRQ  1
+#define TFTP_WRQ  2
+#define TFTP_DATA 3
+#define TFTP_ACK  4
+#define TFTP_OACK 6
+#define BLOCK_SIZE 512
+#define PEER_MAX_BLKSIZE 1468  // largest DATA that fits a 1500 byte MTU
+#define PEER_MAX_WINDOW  16
+
+#define ETH_HLEN 14
+#define IP_HLEN  20
+#define UDP_HLEN 8
+#define MIN_FRAME 60
+
+static const uint8_t dev_mac[6]  = {0x10, 0xe2, 0xd5, 0x00, 0x00, 0x00};
+static const uint8_t peer_mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+static const uint8_t dev_ip[4]   = {10, 0, 11, 2};
+static const uint8_t peer_ip[4]  = {10, 0, 11, 1};
+
+static uint64_t rtt_ns;
+static uint32_t loss_ppm;
+static uint32_t rng = 1;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t rand_ppm(void) {
+  rng = rng * 1664525 + 1013904223;
+  return (rng >> 8) % 1000000;
+}
+
+static uint16_t get16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+static void put16(uint8_t *p, uint16_t v) { p[0] = v >> 8; p[1] = v; }
+
+static uint32_t csum_add(uint32_t r, const uint8_t *p, int len) {
+  int i;
+  for( i = 0; i + 1 < len; i += 2 )
+    r += get16(p + i);
+  if( len & 1 )
+    r += p[len - 1] << 8;
+  return r;
+}
+
+static uint16_t csum_fold(uint32_t r) {
+  while( r >> 16 )
+    r = (r & 0xffff) + (r >> 16);
+  return r;
+}
+
+/////////////// the wire: one FIFO per direction, constant one-way delay of rtt/2, independent random loss
+
+typedef struct frame {
+  uint64_t due;
+  int len;
+  uint8_t data[ETHMAC_SLOT_SIZE];
+} frame;
+
+typedef struct wire {
+  frame q[WIRE_DEPTH];
+  int head, count;
+  uint32_t frames, dropped;
+} wire;
+
+static wire to_peer, to_dev;
+
+static void wire_send(wire *w, const uint8_t *data, int len) {
+  frame *f;
+
+  w->frames++;
+  if( w->count == WIRE_DEPTH || rand_ppm() < loss_ppm ) {
+    w->dropped++;
+    return;
+  }
+  f = &w->q[(w->head + w->count++) % WIRE_DEPTH];
+  f->due = now_ns() + rtt_ns / 2;
+  f->len = len;
+  memcpy(f->data, data, len);
+}
+
+// next frame that has arrived by now, or NULL
+static frame *wire_due(wire *w, uint64_t now) {
+  if( w->count == 0 || w->q[w->head].due > now )
+    return NULL;
+  return &w->q[w->head];
+}
+
+static void wire_pop(wire *w) {
+  w->head = (w->head + 1) % WIRE_DEPTH;
+  w->count--;
+}
+
+/////////////// the peer: ARP responder and TFTP write server
+
+static uint8_t *peer_file;
+static int peer_file_max;
+static int peer_len;
+static int peer_complete;
+static uint16_t peer_port;        // TID of the current transfer
+static uint16_t peer_next_block;
+static uint16_t peer_session = 1024;
+static uint32_t bad_checksums;
+
+// the read side, for -g: the file is src, sent in windows from the block after the last ack
+static int peer_options = 1;       // answer blksize/windowsize with an OACK; 0 is a plain RFC 1350 server
+static const uint8_t *peer_src;
+static int peer_src_len;
+static int peer_reading;
+static int peer_blksize, peer_window;
+static uint32_t peer_acked;        // blocks acked, unwrapped
+static uint32_t peer_nblocks;      // the last one is short, empty if the file is a multiple of the block size
+static uint32_t peer_sent;         // highest block sent
+static uint64_t peer_deadline;     // resend the window if no ack by then
+static uint32_t peer_resent;
+static uint8_t peer_oack[64];
+static int peer_oack_len;
+
+static void peer_send_udp(uint16_t src_port, uint16_t dst_port, const uint8_t *payload, int len) {
+  uint8_t buf[ETHMAC_SLOT_SIZE];
+  uint8_t *ip = buf + ETH_HLEN;
+  uint8_t *udp = ip + IP_HLEN;
+  uint8_t pseudo[12];
+  uint32_t r;
+  int flen = ETH_HLEN + IP_HLEN + UDP_HLEN + len;
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, dev_mac, 6);
+  memcpy(buf + 6, peer_mac, 6);
+  put16(buf + 12, 0x0800);
+
+  ip[0] = 0x45;
+  put16(ip + 2, IP_HLEN + UDP_HLEN + len);
+  put16(ip + 6, 0x4000);
+  ip[8] = 64;
+  ip[9] = 17;
+  memcpy(ip + 12, peer_ip, 4);
+  memcpy(ip + 16, dev_ip, 4);
+  put16(ip + 10, ~csum_fold(csum_add(0, ip, IP_HLEN)));
+
+  put16(udp, src_port);
+  put16(udp + 2, dst_port);
+  put16(udp + 4, UDP_HLEN + len);
+  memcpy(udp + UDP_HLEN, payload, len);
+  memcpy(pseudo, peer_ip, 4);
+  memcpy(pseudo + 4, dev_ip, 4);
+  pseudo[8] = 0;
+  pseudo[9] = 17;
+  put16(pseudo + 10, UDP_HLEN + len);
+  r = ~csum_fold(csum_add(csum_add(0, pseudo, 12), udp, UDP_HLEN + len)) & 0xffff;
+  put16(udp + 6, r ? r : 0xffff);
+
+  wire_send(&to_dev, buf, flen < MIN_FRAME ? MIN_FRAME : flen);
+}
+
+static void peer_ack(uint16_t block) {
+  uint8_t ack[4];
+  put16(ack, TFTP_ACK);
+  put16(ack + 2, block);
+  peer_send_udp(peer_port, PORT_IN, ack, 4);
+}
+
+static void peer_arp(const uint8_t *f, int len) {
+  const uint8_t *arp = f + ETH_HLEN;
+  uint8_t buf[MIN_FRAME];
+
+  if( len < ETH_HLEN + 28 || get16(arp + 6) != 1 || memcmp(arp + 24, peer_ip, 4) )
+    return;
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, arp + 8, 6);
+  memcpy(buf + 6, peer_mac, 6);
+  put16(buf + 12, 0x0806);
+  memcpy(buf + ETH_HLEN, arp, 6);            // hwtype, proto, sizes
+  put16(buf + ETH_HLEN + 6, 2);              // reply
+  memcpy(buf + ETH_HLEN + 8, peer_mac, 6);
+  memcpy(buf + ETH_HLEN + 14, peer_ip, 4);
+  memcpy(buf + ETH_HLEN + 18, arp + 8, 10);  // requester's MAC and IP
+  wire_send(&to_dev, buf, sizeof(buf));
+}
+
+static void peer_send_window(void) {
+  uint8_t buf[4 + PEER_MAX_BLKSIZE];
+  uint32_t b, last = peer_acked + peer_window;
+  int off, n;
+
+  if( last > peer_nblocks )
+    last = peer_nblocks;
+  for( b = peer_acked + 1; b <= last; b++ ) {
+    off = (b - 1) * peer_blksize;
+    n = peer_src_len - off < peer_blksize ? peer_src_len - off : peer_blksize;
+    put16(buf, TFTP_DATA);
+    put16(buf + 2, b);
+    memcpy(buf + 4, peer_src + off, n);
+    if( b <= peer_sent )
+      peer_resent++;
+    else
+      peer_sent = b;
+    peer_send_udp(peer_port, PORT_IN, buf, 4 + n);
+  }
+  peer_deadline = now_ns() + 2 * rtt_ns + 5000000;
+}
+
+static void peer_send_oack(void) {
+  peer_send_udp(peer_port, PORT_IN, peer_oack, peer_oack_len);
+  peer_deadline = now_ns() + 2 * rtt_ns + 5000000;
+}
+
+// RRQ: filename, mode, then option name/value pairs
+static void peer_rrq(const uint8_t *p, int len) {
+  const char *s = (const char *) p + 2, *end = (const char *) p + len;
+  int blksize = 0, window = 0;
+
+  s += strlen(s) + 1;  // filename
+  s += strlen(s) + 1;  // mode
+  while( s < end ) {
+    const char *name = s, *value = s + strlen(s) + 1;
+    if( value >= end )
+      break;
+    if( strcmp(name, "blksize") == 0 )
+      blksize = atoi(value);
+    else if( strcmp(name, "windowsize") == 0 )
+      window = atoi(value);
+    s = value + strlen(value) + 1;
+  }
+
+  peer_port = ++peer_session;
+  peer_reading = 1;
+  peer_acked = 0;
+  peer_sent = 0;
+  peer_blksize = BLOCK_SIZE;
+  peer_window = 1;
+  peer_oack_len = 0;
+  if( peer_options && (blksize || window) ) {
+    put16(peer_oack, TFTP_OACK);
+    peer_oack_len = 2;
+    if( blksize ) {
+      peer_blksize = blksize < PEER_MAX_BLKSIZE ? blksize : PEER_MAX_BLKSIZE;
+      peer_oack_len += sprintf((char *) peer_oack + peer_oack_len, "blksize%c%d", 0, peer_blksize) + 1;
+    }
+    if( window ) {
+      peer_window = window < PEER_MAX_WINDOW ? window : PEER_MAX_WINDOW;
+      peer_oack_len += sprintf((char *) peer_oack + peer_oack_len, "windowsize%c%d", 0, peer_window) + 1;
+    }
+  }
+  peer_nblocks = peer_src_len / peer_blksize + 1;
+  if( peer_oack_len )
+    peer_send_oack();
+  else
+    peer_send_window();
+}
+
+static void peer_read_ack(uint16_t block) {
+  uint16_t ahead = block - (uint16_t) peer_acked;
+
+  if( ahead > peer_window )
+    return;  // older than the last ack
+  peer_acked += ahead;
+  if( peer_acked == peer_nblocks ) {
+    peer_reading = 0;
+    peer_complete = 1;
+    return;
+  }
+  peer_send_window();  // a repeated ack asks for the window again from there
+}
+
+static void peer_tftp(uint16_t src_port, uint16_t dst_port, const uint8_t *p, int len) {
+  uint16_t block;
+  int n;
+
+  if( src_port != PORT_IN || len < 4 )
+    return;
+  if( dst_port == TFTP_SERVER_PORT && get16(p) == TFTP_RRQ ) {
+    peer_complete = 0;
+    peer_rrq(p, len);
+    return;
+  }
+  if( dst_port == peer_port && peer_reading && get16(p) == TFTP_ACK ) {
+    peer_read_ack(get16(p + 2));
+    return;
+  }
+  if( dst_port == TFTP_SERVER_PORT && get16(p) == TFTP_WRQ ) {
+    // a retried WRQ gets a fresh transfer, like tftpd
+    peer_port = ++peer_session;
+    peer_len = 0;
+    peer_complete = 0;
+    peer_next_block = 1;
+    peer_ack(0);
+    return;
+  }
+  if( dst_port != peer_port || get16(p) != TFTP_DATA )
+    return;
+
+  block = get16(p + 2);
+  n = len - 4;
+  if( block == peer_next_block && !peer_complete ) {
+    if( peer_len + n > peer_file_max )
+      n = peer_file_max - peer_len;
+    memcpy(peer_file + peer_len, p + 4, n);
+    peer_len += n;
+    peer_next_block++;
+    if( len - 4 < BLOCK_SIZE )
+      peer_complete = 1;
+  } else if( (uint16_t) (block + 1) != peer_next_block ) {
+    return;  // neither the next block nor a retry of the last one
+  }
+  peer_ack(block);
+}
+
+static void peer_rx(const uint8_t *f, int len) {
+  const uint8_t *ip = f + ETH_HLEN;
+  const uint8_t *udp = ip + IP_HLEN;
+  uint8_t pseudo[12];
+  int ulen;
+
+  if( len < ETH_HLEN + 2 )
+    return;
+  if( get16(f + 12) == 0x0806 ) {
+    peer_arp(f, len);
+    return;
+  }
+  if( get16(f + 12) != 0x0800 || len < ETH_HLEN + IP_HLEN + UDP_HLEN || ip[9] != 17 )
+    return;
+
+  ulen = get16(udp + 4);
+  memcpy(pseudo, ip + 12, 8);
+  pseudo[8] = 0;
+  pseudo[9] = 17;
+  put16(pseudo + 10, ulen);
+  if( csum_fold(csum_add(0, ip, IP_HLEN)) != 0xffff ||
+      get16(ip + 2) != IP_HLEN + ulen || ETH_HLEN + IP_HLEN + ulen > len ||
+      (get16(udp + 6) && csum_fold(csum_add(csum_add(0, pseudo, 12), udp, ulen)) != 0xffff) ) {
+    bad_checksums++;
+    return;
+  }
+  peer_tftp(get16(udp), get16(udp + 2), udp + UDP_HLEN, ulen - UDP_HLEN);
+}
+
+/////////////// the MAC: LiteEthMAC's SRAM slots and CSRs, with the wire pumped whenever the firmware polls
+
+unsigned char ethmac_sim_mem[ETHMAC_SLOT_SIZE * (ETHMAC_RX_SLOTS + ETHMAC_TX_SLOTS)];
+
+static unsigned char tx_slot, rx_slot, rx_pending;
+static uint16_t tx_len;
+static uint32_t rx_len;
+static uint64_t systime_latched;
+
+// per-block round trip as the firmware sees it: DATA handed to the MAC to its ACK landing in an rx slot
+static uint16_t data_block;
+static uint64_t data_sent;
+static uint32_t retransmits;
+static uint64_t block_rtt_sum, block_rtt_min, block_rtt_max;
+static uint32_t block_rtts;
+
+static void sim_pump(void) {
+  uint64_t now = now_ns();
+  const uint8_t *udp;
+  frame *f;
+
+  while( (f = wire_due(&to_peer, now)) ) {
+    peer_rx(f->data, f->len);
+    wire_pop(&to_peer);
+  }
+  if( peer_reading && now > peer_deadline ) {
+    if( peer_sent == 0 && peer_oack_len )
+      peer_send_oack();  // like tftpd, the OACK is resent until block 0 is acked
+    else
+      peer_send_window();
+  }
+  if( rx_pending || !(f = wire_due(&to_dev, now)) )
+    return;
+
+  memcpy(ethmac_sim_mem + ETHMAC_SLOT_SIZE * rx_slot, f->data, f->len);
+  rx_len = f->len;
+  rx_pending = 1;
+  udp = f->data + ETH_HLEN + IP_HLEN;
+  if( get16(f->data + 12) == 0x0800 && get16(udp + UDP_HLEN) == TFTP_ACK &&
+      get16(udp + UDP_HLEN + 2) == data_block && data_sent ) {
+    uint64_t t = now - data_sent;
+    block_rtt_sum += t;
+    if( block_rtts == 0 || t < block_rtt_min )
+      block_rtt_min = t;
+    if( t > block_rtt_max )
+      block_rtt_max = t;
+    block_rtts++;
+    data_sent = 0;
+  }
+  wire_pop(&to_dev);
+}
+
+unsigned char ethmac_sram_reader_ready_read(void) {
+  return 1;
+}
+
+void ethmac_sram_reader_slot_write(unsigned char value) {
+  tx_slot = value;
+}
+
+void ethmac_sram_reader_length_write(uint16_t value) {
+  tx_len = value;
+}
+
+void ethmac_sram_reader_start_write(unsigned char value) {
+  const uint8_t *f = ethmac_sim_mem + ETHMAC_SLOT_SIZE * (ETHMAC_RX_SLOTS + tx_slot);
+  const uint8_t *udp = f + ETH_HLEN + IP_HLEN;
+
+  if( get16(f + 12) == 0x0800 && get16(udp + UDP_HLEN) == TFTP_DATA ) {
+    if( get16(udp + UDP_HLEN + 2) == data_block )
+      retransmits++;
+    data_block = get16(udp + UDP_HLEN + 2);
+    data_sent = now_ns();
+  }
+  wire_send(&to_peer, f, tx_len);
+}
+
+void ethmac_sram_reader_ev_pending_write(unsigned char value) {
+}
+
+unsigned char ethmac_sram_writer_ev_pending_read(void) {
+  sim_pump();
+  return rx_pending ? ETHMAC_EV_SRAM_WRITER : 0;
+}
+
+void ethmac_sram_writer_ev_pending_write(unsigned char value) {
+  if( value & ETHMAC_EV_SRAM_WRITER && rx_pending ) {
+    rx_pending = 0;
+    rx_slot = (rx_slot + 1) % ETHMAC_RX_SLOTS;
+  }
+}
+
+unsigned char ethmac_sram_writer_slot_read(void) {
+  return rx_slot;
+}
+
+uint32_t ethmac_sram_writer_length_read(void) {
+  return rx_len;
+}
+
+// systime ticks at CONFIG_CLOCK_FREQUENCY, from the host's monotonic clock
+void systime_latch_write(uint32_t value) {
+  systime_latched = now_ns() / (1000000000 / CONFIG_CLOCK_FREQUENCY);
+}
+
+uint64_t systime_value_read(void) {
+  return systime_latched;
+}
+
+/////////////// benchmark
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-g [-o]] [-s bytes] [-n transfers] [-r rtt_us] [-l loss_percent] [-q seed]\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  int size = 65536, reps = 10;
+  double loss = 0;
+  uint8_t *src, *dst;
+  uint32_t server = IPTOINT(peer_ip[0], peer_ip[1], peer_ip[2], peer_ip[3]);
+  uint64_t t, start, total = 0, worst = 0;
+  int opt, i, failures = 0, get = 0;
+
+  while( (opt = getopt(argc, argv, "gos:n:r:l:q:")) != -1 ) {
+    switch( opt ) {
+    case 'g': get = 1; break;
+    case 'o': peer_options = 0; break;
+    case 's': size = atoi(optarg); break;
+    case 'n': reps = atoi(optarg); break;
+    case 'r': rtt_ns = (uint64_t) atoi(optarg) * 1000; break;
+    case 'l': loss = atof(optarg); break;
+    case 'q': rng = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if( size < 0 || reps < 1 || loss < 0 || loss >= 100 )
+    usage(argv[0]);
+  loss_ppm = loss * 10000;
+
+  src = malloc(size + 1);
+  dst = malloc(size + 1);
+  peer_src = src;
+  peer_src_len = size;
+  peer_file = malloc(size + 1);
+  peer_file_max = size + 1;  // room for one stray byte, so an overlong upload shows up as a mismatch
+  for( i = 0; i < size; i++ )
+    src[i] = rand_ppm() >> 3;
+
+  trace_clear();
+  microudp_start(dev_mac, dev_ip[0], dev_ip[1], dev_ip[2], dev_ip[3]);
+
+  for( i = 0; i < reps; i++ ) {
+    int sent, got;
+
+    if( get ) {
+      memset(dst, 0, size + 1);
+      start = now_ns();
+      got = tftp_get(server, TFTP_SERVER_PORT, "bench.bin", dst, size);
+      t = now_ns() - start;
+      total += t;
+      if( t > worst )
+	worst = t;
+      if( got != size || memcmp(dst, src, size) ) {
+	printf("transfer %d FAILED: tftp_get returned %d\n", i, got);
+	failures++;
+      }
+      continue;
+    }
+
+    start = now_ns();
+    sent = tftp_put(server, TFTP_SERVER_PORT, "bench.bin", src, size);
+    t = now_ns() - start;
+    total += t;
+    if( t > worst )
+      worst = t;
+    if( sent != size || !peer_complete || peer_len != size || memcmp(peer_file, src, size) ) {
+      printf("transfer %d FAILED: tftp_put returned %d, peer has %d bytes%s\n", i, sent, peer_len,
+	     peer_complete ? "" : " (incomplete)");
+      failures++;
+    }
+  }
+
+  if( get )
+    printf("tftp_get %d bytes x%d, rtt %d us, loss %.2f%%, server %s\n", size, reps, (int) (rtt_ns / 1000), loss,
+	   peer_options ? "takes blksize and windowsize" : "without options");
+  else
+    printf("tftp_put %d bytes x%d, rtt %d us, loss %.2f%%\n", size, reps, (int) (rtt_ns / 1000), loss);
+  printf("  throughput %.0f KB/s, transfer mean %.2f ms max %.2f ms\n",
+	 (double) size * reps / 1024 / (total / 1e9), total / 1e6 / reps, worst / 1e6);
+  if( block_rtts )
+    printf("  block rtt min/mean/max %.1f/%.1f/%.1f us over %d blocks\n", block_rtt_min / 1e3,
+	   block_rtt_sum / 1e3 / block_rtts, block_rtt_max / 1e3, block_rtts);
+  if( get )
+    printf("  block size %d, window %d, %d blocks resent by the server\n", peer_blksize, peer_window, peer_resent);
+  printf("  %d retransmits, frames dropped %d/%d to peer, %d/%d to device\n", retransmits,
+	 to_peer.dropped, to_peer.frames, to_dev.dropped, to_dev.frames);
+
+  // every data block retransmit the wire saw should be in the event trace, as long as the ring didn't wrap
+  if( !get && trace.head <= TRACE_ENTRIES ) {
+    uint32_t traced = 0;
+    for( i = 0; i < (int) trace.head; i++ )
+      if( trace.entry[i].event == TRACE_TFTP_RETRY && trace.entry[i].a != 0 )
+	traced++;
+    if( traced != retransmits ) {
+      printf("FAIL: %d retransmits traced, %d on the wire\n", traced, retransmits);
+      failures++;
+    }
+  }
+  if( bad_checksums ) {
+    printf("FAIL: %d frames from the device had bad IP/UDP checksums\n", bad_checksums);
+    failures++;
+  }
+  if( failures ) {
+    printf("FAIL\n");
+    return 1;
+  }
+  printf("PASS\n");
+  return 0;
+}
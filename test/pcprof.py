@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+# Symbolized report for the firmware's PC sampling profiler. On the device:
+#   profile start 1000
+#   ... run the workload ...
+#   profile stop
+#   profile dump            (tftp_puts zappy-profile to the host)
+# then on the host:
+#   ./pcprof.py zappy-profile ../firmware/firmware.elf
+# Buckets are attributed to the function containing their first byte, so with more than a few bytes per bucket
+# the edges of short functions can be off by a bucket.
+
+import argparse
+import bisect
+import struct
+import subprocess
+
+PROFILE_MAGIC = 0x5a505232
+HEADER = struct.Struct("<10I")  # magic, text_base, shift, nbuckets, rate_hz, samples, outside, fast_base, fast_shift, fast_size
+FAST_BUCKETS = 512
+
+
+def load_profile(fname):
+    with open(fname, "rb") as f:
+        data = f.read()
+    magic, text_base, shift, nbuckets, rate_hz, samples, outside, fast_base, fast_shift, fast_size = \
+        HEADER.unpack_from(data)
+    if magic != PROFILE_MAGIC:
+        raise SystemExit("{}: not a profile dump (magic {:08x})".format(fname, magic))
+    counts = struct.unpack_from("<{}H".format(nbuckets), data, HEADER.size)
+    fast_counts = struct.unpack_from("<{}H".format(FAST_BUCKETS), data, HEADER.size + 2 * nbuckets)
+    # both histograms as (bucket address, count), so the .fast code in sram is attributed like the rest
+    buckets = [(text_base + (i << shift), n) for i, n in enumerate(counts) if n]
+    buckets += [(fast_base + (i << fast_shift), n) for i, n in enumerate(fast_counts) if n]
+    return shift, rate_hz, samples, outside, buckets
+
+
+def load_symbols(elf, nm):
+    out = subprocess.check_output([nm, "-n", "--defined-only", elf]).decode()
+    addrs = []
+    names = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            addrs.append(int(fields[0], 16))
+            names.append(fields[2])
+    return addrs, names
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report a zappy-profile dump by function")
+    parser.add_argument("profile", help="zappy-profile file from 'profile dump'")
+    parser.add_argument("elf", help="firmware.elf the device is running")
+    parser.add_argument("--nm", default="riscv64-unknown-elf-nm", help="nm for the firmware toolchain")
+    parser.add_argument("--top", type=int, default=30, help="functions to list")
+    args = parser.parse_args()
+
+    shift, rate_hz, samples, outside, buckets = load_profile(args.profile)
+    addrs, names = load_symbols(args.elf, args.nm)
+
+    per_func = {}
+    for addr, n in buckets:
+        idx = bisect.bisect_right(addrs, addr) - 1
+        name = names[idx] if idx >= 0 else "0x{:08x}".format(addr)
+        per_func[name] = per_func.get(name, 0) + n
+
+    print("{} samples at {} Hz ({:.1f} s), {} outside .text and .fast, {} bytes per .text bucket".format(
+        samples, rate_hz, samples / rate_hz if rate_hz else 0, outside, 1 << shift))
+    if samples == 0:
+        return
+    print("{:>8} {:>6}  function".format("samples", "%"))
+    for name, n in sorted(per_func.items(), key=lambda kv: kv[1], reverse=True)[:args.top]:
+        print("{:>8} {:>6.2f}  {}".format(n, 100.0 * n / samples, name))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Build report for the __fast hot paths (firmware/fast.h): where each hot function landed, and how big the .fast
+# section is against the sram it shares with the stack. Run after a firmware build:
+#   ./placement.py ../firmware/firmware.elf
+# A USE_FAST=no build shows every one of them back in .text, which is the point of comparison for 'bench'.
+
+import argparse
+import subprocess
+
+# the functions fast.h is meant for; anything else found in .fast is listed too
+HOT = [
+    "isr", "profile_isr",
+    "systime_now", "systime_elapsed_since", "systime_expired",
+    "phase_add", "stats_record",
+    "microudp_service", "process_frame", "process_ip", "microudp_send", "ip_checksum", "send_packet",
+    "tftp_put", "rx_callback", "format_data",
+    "wait_until_voltage", "wait_until_safe", "read_pulse_summary", "zap_poll_bench",
+]
+SRAM_STACK_MIN = 0x2000  # the linker scripts' ASSERT
+
+
+def load_sections(elf, objdump):
+    out = subprocess.check_output([objdump, "-h", elf]).decode()
+    sections = []
+    for line in out.splitlines():
+        fields = line.split()
+        # Idx Name Size VMA LMA File-off Algn
+        if len(fields) == 7 and fields[0].isdigit():
+            sections.append((fields[1], int(fields[3], 16), int(fields[2], 16)))
+    return sections
+
+
+def load_symbols(elf, nm):
+    out = subprocess.check_output([nm, "-S", "--defined-only", elf]).decode()
+    syms = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 4 and fields[2] in "tTwW":
+            syms[fields[3]] = (int(fields[0], 16), int(fields[1], 16))
+    return syms
+
+
+def section_of(sections, addr):
+    for name, vma, size in sections:
+        if vma <= addr < vma + size:
+            return name
+    return "?"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report where the firmware's hot paths were linked")
+    parser.add_argument("elf", help="firmware.elf")
+    parser.add_argument("--nm", default="riscv64-unknown-elf-nm", help="nm for the firmware toolchain")
+    parser.add_argument("--objdump", default="riscv64-unknown-elf-objdump", help="objdump for the firmware toolchain")
+    parser.add_argument("--sram-size", type=lambda x: int(x, 0), default=16 * 1024, help="sram bytes")
+    args = parser.parse_args()
+
+    sections = load_sections(args.elf, args.objdump)
+    syms = load_symbols(args.elf, args.nm)
+    fast = [s for s in sections if s[0] == ".fast"]
+
+    names = list(HOT)
+    if fast:
+        _, base, size = fast[0]
+        names += sorted(n for n, (a, _) in syms.items() if base <= a < base + size and n not in HOT)
+    print("{:<24} {:>10} {:>6}  section".format("function", "address", "bytes"))
+    for name in names:
+        if name not in syms:
+            print("{:<24} {:>10} {:>6}  (not in this build)".format(name, "-", "-"))
+            continue
+        addr, size = syms[name]
+        print("{:<24} {:08x}   {:>6}  {}".format(name, addr, size, section_of(sections, addr)))
+
+    if not fast or fast[0][2] == 0:
+        print(".fast is empty: a USE_FAST=no build, everything runs from main_ram")
+        return
+    _, base, size = fast[0]
+    sram_base = base & ~(args.sram_size - 1)
+    stack = sram_base + args.sram_size - (base + size)
+    print(".fast: {} bytes at {:08x}, {} bytes of sram left for the stack (linker minimum {})".format(
+        size, base, stack, SRAM_STACK_MIN))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# Decoder for the firmware's post-mortem event trace. On the device:
+#   trace dump              (tftp_puts zappy-trace to the host)
+# then on the host:
+#   ./trace.py zappy-trace
+# or, if the firmware is wedged but the bus still answers, read the ring straight out of RAM over Etherbone, at the
+# address "trace" prints (or from nm firmware.elf | grep ' trace$'):
+#   ./trace.py --etherbone 0x40012340
+# The ring survives a soft reboot, so records are split into boot epochs; times restart at each boot.
+
+import argparse
+import struct
+
+TRACE_MAGIC = 0x5a545231
+HEADER = struct.Struct("<4I")  # magic, clock_hz, nentries, head
+ENTRY = struct.Struct("<QHHI")  # time, event, a, b
+
+SCRAM_WHERE = ["start", "sequence", "protocol"]
+END_CAUSES = ["time", "energy", "arc", "slope"]  # zappio end_cause bits
+
+
+def well(a):
+    return "r{}c{}".format((a >> 4 & 0xF) + 1, (a & 0xF) + 1)
+
+
+def end_cause(bits):
+    causes = [name for i, name in enumerate(END_CAUSES) if bits & (1 << i)]
+    return "+".join(causes) if causes else "end of capture"
+
+
+def ip(b):
+    return "{}.{}.{}.{}".format(b >> 24, b >> 16 & 0xFF, b >> 8 & 0xFF, b & 0xFF)
+
+
+# event number: (name, formatter of a, b)
+EVENTS = {
+    1: ("boot", lambda a, b: "{} records before".format(b)),
+    2: ("zap_start", lambda a, b: "{} V, {} wells".format(a, b)),
+    3: ("zap_end", lambda a, b: "aborted" if a else "ok"),
+    4: ("charge_start", lambda a, b: "{} V".format(a)),
+    5: ("charge_retry", lambda a, b: "retry {}, stalled at code {}".format(a, b)),
+    6: ("charge_done", lambda a, b: "{}, {} retries".format(["converged", "timeout", "overshoot"][a]
+                                                              if a < 3 else a, b)),
+    7: ("trigger", lambda a, b: "{} at {} V".format(well(a), b)),
+    8: ("pulse_end", lambda a, b: "{} sequencer result {:08x}".format(well(a), b) if a >> 8 == 0 and b & 0x80000000
+        else "{} by {} after {} cycles".format(well(a), end_cause(a >> 8), b)),
+    9: ("energy_cutoff", lambda a, b: "{} accumulator {}".format(well(a), b)),
+    10: ("arc", lambda a, b: "{} {} samples after the trigger".format(well(a), b)),
+    11: ("scram", lambda a, b: "{} at index {}".format(SCRAM_WHERE[a] if a < len(SCRAM_WHERE) else a, b)),
+    12: ("tftp_retry", lambda a, b: "{}, {} tries left".format("block {}".format(a) if a else "request", b)),
+    13: ("tftp_fail", lambda a, b: "block {} to {}".format(a, ip(b))),
+    14: ("arp_miss", lambda a, b: ip(b)),
+    15: ("motor_jam", lambda a, b: "{} mA, target {} mrad".format(a, b - (1 << 32) if b & 0x80000000 else b)),
+    16: ("i2c_error", lambda a, b: "addr 0x{:02x}, {} errors".format(a, b)),
+}
+
+
+def decode(data):
+    magic, clock_hz, nentries, head = HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC:
+        raise SystemExit("not a trace dump (magic {:08x})".format(magic))
+    first = max(0, head - nentries)
+    records = []
+    for i in range(first, head):
+        records.append((i,) + ENTRY.unpack_from(data, HEADER.size + (i % nentries) * ENTRY.size))
+    return clock_hz, head, records
+
+
+def read_etherbone(addr):
+    from litex.tools.litex_client import RemoteClient
+
+    wb = RemoteClient()
+    wb.open()
+    words = wb.read(addr, HEADER.size // 4)
+    nentries = words[2]
+    words += wb.read(addr + HEADER.size, nentries * ENTRY.size // 4)
+    wb.close()
+    return struct.pack("<{}I".format(len(words)), *words)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode the zappy event trace")
+    parser.add_argument("dump", nargs="?", help="zappy-trace file from 'trace dump'")
+    parser.add_argument("--etherbone", type=lambda x: int(x, 0), help="read the ring at this address instead")
+    parser.add_argument("--last", type=int, default=0, help="only the last n records")
+    args = parser.parse_args()
+
+    if args.etherbone is not None:
+        data = read_etherbone(args.etherbone)
+    elif args.dump:
+        with open(args.dump, "rb") as f:
+            data = f.read()
+    else:
+        parser.error("need a dump file or --etherbone")
+
+    clock_hz, head, records = decode(data)
+    print("{} records written, {} in the ring".format(head, len(records)))
+    if args.last:
+        records = records[-args.last:]
+    for i, t, event, a, b in records:
+        name, fmt = EVENTS.get(event, ("event {}".format(event), lambda a, b: "a {} b 0x{:08x}".format(a, b)))
+        if event == 1:
+            print("---- boot")
+        print("{:6} {:12.6f} {:14} {}".format(i, t / clock_hz, name, fmt(a, b)))
+
+
+if __name__ == "__main__":
+    main()
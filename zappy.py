@@ -24,6 +24,7 @@ from litex.soc.integration.builder import *
 
 from litex.soc.cores import spi_flash
 from litex.soc.cores import uart
+from litex.soc.cores.timer import Timer
 
 from migen.genlib.resetsync import AsyncResetSynchronizer
 
@@ -44,6 +45,10 @@ from gateware.pwm import PWM
 from gateware.zappy_i2c import ZappyI2C
 from gateware.oled import OLED
 from gateware.zappio import Zappio
+from gateware.motor_uart import MotorUART
+from gateware.sequencer import ZapSequencer
+from gateware.charge_ctl import ChargeController
+from gateware.systime import SysTime
 
 import lxsocdoc
 
@@ -273,8 +278,9 @@ class Platform(XilinxPlatform):
             XilinxPlatform.__init__(self, part, _io_netv2,
                                     toolchain=toolchain)
 
-        # NOTE: to do quad-SPI mode, the QE bit has to be set in the SPINOR status register
-        # OpenOCD won't do this natively, have to find a work-around (like using iMPACT to set it once)
+        # NOTE: the populated N25Q128 takes quad I/O reads without a QE bit (unlike Spansion/Macronix parts, which need
+        # it set once in the status register before spiflash_4x works); its DQ3 only acts as HOLD# in single/dual modes.
+        # The bitstream loads over x2 whichever read mode the SoC uses
         self.add_platform_command(
             "set_property CONFIG_VOLTAGE 3.3 [current_design]")
         self.add_platform_command(
@@ -407,13 +413,18 @@ class CRG(Module, AutoCSR):
 
 boot_offset = 0x1000000
 bios_size = 0x6000
+xip_offset = 0x800000  # flash offset of the firmware's execute-in-place code, just above the 0x7b0000 boot image
+xip_size = 0x100000
 
 class ZappySoC(SoCCore):
     mem_map = {
         "spiflash": 0x20000000,  # (default shadow @0xa0000000)
         "ethmac":   0x30000000,  # (shadow @0xb0000000)
         "monitor":  0x50000000,  # was: memtest
+        "sequencer": 0x70000000,
     }
+    # mem_decoder() only compares address bits 28-30, so every wishbone slave needs its own 0x10000000 slot; SoCCore
+    # adds rom 0x0, sram 0x1, main_ram 0x4 and csr 0x6
     mem_map.update(SoCCore.mem_map)
 
     def __init__(self, platform, spiflash="spiflash_1x", **kwargs):
@@ -439,6 +450,11 @@ class ZappySoC(SoCCore):
         self.add_csr("info")
         self.submodules.led = led.ClassicLed(platform.request("blinkenlight", 0))
         self.add_csr("led")
+        self.submodules.systime = SysTime()
+        self.add_csr("systime")
+        self.submodules.timer1 = Timer()  # spare timer, interrupts drive the firmware's PC sampling profiler
+        self.add_csr("timer1")
+        self.add_interrupt("timer1")
 
         # spi flash
         spiflash_pads = platform.request(spiflash)
@@ -446,9 +462,12 @@ class ZappySoC(SoCCore):
         self.specials += Instance("STARTUPE2",
                                   i_CLK=0, i_GSR=0, i_GTS=0, i_KEYCLEARB=0, i_PACK=0,
                                   i_USRCCLKO=spiflash_pads.clk, i_USRCCLKTS=0, i_USRDONEO=1, i_USRDONETS=1)
+        # dummy clocks after the address, for the N25Q128 at its power-on dummy setting (NVCR bits 15:12 = 1111); specific
+        # to the device populated on the board -- if it changes, must be updated
         spiflash_dummy = {
-            "spiflash_1x": 8,  # this is specific to the device populated on the board -- if it changes, must be updated
-            "spiflash_4x": 12, # this is almost certainly wrong
+            "spiflash_1x": 8,   # FAST_READ (0x0B)
+            "spiflash_4x": 10,  # quad I/O fast read (0xEB): 1-4-4, the first dummy clock carries the XIP confirmation bit,
+                                # which the flash ignores while volatile XIP mode is off (its reset state)
         }
         self.submodules.spiflash = spi_flash.SpiFlash(
                 spiflash_pads,
@@ -462,6 +481,9 @@ class ZappySoC(SoCCore):
             "spiflash", self.mem_map["spiflash"] | self.shadow_base, 512*1024*1024)
 
         self.flash_boot_address = 0x207b0000
+        # firmware built with XIP=yes runs its cold code straight out of flash at the cached address, through the
+        # VexRiscv icache; see firmware/linker-xip.ld
+        self.add_memory_region("xip", self.mem_map["spiflash"] + xip_offset, xip_size)
 
         self.platform.add_platform_command(
             "create_clock -name clk50 -period 20.0 [get_nets clk50]")
@@ -509,8 +531,10 @@ class ZappySoC(SoCCore):
         self.add_csr("oled")
 
         # add motor UART interface
+        # boots at 115200 to match the motor; firmware raises the rate via motor_phy tuning_word after negotiating
         self.submodules.motor_phy = uart.RS232PHY(platform.request("mot", 0), clk_freq, 115200)
-        self.submodules.motor = ResetInserter()(uart.UART(self.motor_phy))
+        self.submodules.motor = ResetInserter()(MotorUART(self.motor_phy, fifo_depth=128,
+                                                          rx_timeout=int(clk_freq * 20 / 115200)))  # ~2 characters idle
         self.add_csr("motor_phy", allow_user_defined=True)
         self.add_csr("motor", allow_user_defined=True)
         self.add_interrupt("motor", allow_user_defined=True)
@@ -526,7 +550,7 @@ class ZappySoC(SoCCore):
         self.add_csr("zappio")
 
         # add zap monitoring interface
-        memdepth = 16384
+        memdepth = 32768  # room for a full plate of sequenced captures; single zaps still use the first 16384
         self.submodules.monitor = Zappy_adc(platform.request("adc", 0), platform.request("fadc", 0), memdepth=memdepth)
         self.add_csr("monitor")
         self.add_wb_slave(mem_decoder(self.mem_map["monitor"]), self.monitor.bus)
@@ -537,6 +561,37 @@ class ZappySoC(SoCCore):
         self.comb += self.zappio.energy_cutoff.eq(self.monitor.energy_cutoff) # wire up the energy cutoff signal
         self.comb += self.buzzpwm.hardware_ena.eq(self.zappio.hv_engage_gpio) # wire up buzzer to beep whenever HV is engaged
         self.comb += self.zappio.delta.eq(self.monitor.livedelta) # wire up the delta computation from the monitor
+        self.comb += [ # and the samples it's computed from, for the arc slope detector
+            self.zappio.fast.eq(self.monitor.fast_sample),
+            self.zappio.sample_strobe.eq(self.monitor.slow_strobe),
+        ]
+
+        # closed-loop HV charging: slow-path samples from the monitor in, HV DAC code out through zappio
+        self.submodules.hvctl = ChargeController()
+        self.add_csr("hvctl")
+        self.comb += [
+            self.hvctl.sample.eq(self.monitor.slow_sample),
+            self.hvctl.strobe.eq(self.monitor.slow_strobe),
+            self.hvctl.target.eq(self.monitor.charge_target_out),
+            self.hvctl.hold.eq(self.zappio.engaged),
+            self.hvctl.dac_ready.eq(self.zappio.hv_dac_ready),
+            self.zappio.hv_auto.eq(self.hvctl.active),
+            self.zappio.hv_auto_code.eq(self.hvctl.code),
+            self.zappio.hv_auto_update.eq(self.hvctl.update),
+        ]
+
+        # autonomous plate sequencer, drives zappio + monitor from a per-well table
+        seq_entries = 48
+        self.submodules.sequencer = ZapSequencer(self.monitor, self.zappio, entries=seq_entries)
+        # each well waits for the cap to be back in band, when firmware has the charge comparator running;
+        # protocol entries with their own HV code also hand it to the charge controller as its feedforward
+        self.comb += [
+            self.sequencer.ready.eq(~self.monitor.charge_ctl.fields.enable | self.monitor.charged_out),
+            self.hvctl.ff_code.eq(self.sequencer.hv_code),
+        ]
+        self.add_csr("sequencer")
+        self.add_wb_slave(mem_decoder(self.mem_map["sequencer"]), self.sequencer.bus)
+        self.add_memory_region("sequencer", self.mem_map["sequencer"] | self.shadow_base, seq_entries * 8 * 4)
 
         from litescope import LiteScopeAnalyzer
 
@@ -581,6 +636,10 @@ def main():
     parser.add_argument(
         "-D", "--document-only", default=False, action="store_true", help="Build docs only"
     )
+    parser.add_argument(
+        "-s", "--spiflash", help="SPI flash read mode; 4x (quad I/O) is not yet tried on hardware", choices=["1x", "4x"],
+        default="1x"
+    )
     args = parser.parse_args()
     compile_gateware = True
     compile_software = True
@@ -596,7 +655,7 @@ def main():
     else:
         exit(1)
 
-    soc = ZappySoC(platform)
+    soc = ZappySoC(platform, spiflash="spiflash_" + args.spiflash)
     builder = Builder(soc, output_dir="build", csr_csv="test/csr.csv", compile_software=compile_software, compile_gateware=compile_gateware)
     vns = builder.build()
     soc.do_exit(vns)